@@ -0,0 +1,101 @@
+// Heap allocation counter preloaded into the host by the benchmark driver.
+//
+// Every malloc family call of the host process (and of the plugin it loads)
+// increments a counter that lives in the file named by VSTHOST_ALLOC_COUNTER,
+// which the driver maps as well and samples around each command. Only glibc
+// is supported, the real allocator is reached through its __libc_ entry
+// points so no dlsym bootstrapping is needed.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+
+extern "C"
+{
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t count, size_t size);
+    void* __libc_realloc(void* block, size_t size);
+    void* __libc_memalign(size_t alignment, size_t size);
+}
+
+namespace
+{
+    std::atomic<uint64_t> early_count{ 0 };
+    std::atomic<uint64_t>* counter = &early_count;
+
+    inline void count()
+    {
+        counter->fetch_add(1, std::memory_order_relaxed);
+    }
+
+    __attribute__((constructor)) void map_counter()
+    {
+        const char* path = getenv("VSTHOST_ALLOC_COUNTER");
+
+        if (path == nullptr)
+            return;
+
+        int fd = open(path, O_RDWR);
+
+        if (fd < 0)
+            return;
+
+        void* view = mmap(nullptr, sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        close(fd);
+
+        if (view != MAP_FAILED)
+            counter = new (view) std::atomic<uint64_t>(0);
+    }
+}
+
+extern "C"
+{
+    __attribute__((visibility("default"))) void* malloc(size_t size)
+    {
+        count();
+        return __libc_malloc(size);
+    }
+
+    __attribute__((visibility("default"))) void* calloc(size_t count_, size_t size)
+    {
+        count();
+        return __libc_calloc(count_, size);
+    }
+
+    __attribute__((visibility("default"))) void* realloc(void* block, size_t size)
+    {
+        count();
+        return __libc_realloc(block, size);
+    }
+
+    __attribute__((visibility("default"))) void* memalign(size_t alignment, size_t size)
+    {
+        count();
+        return __libc_memalign(alignment, size);
+    }
+
+    __attribute__((visibility("default"))) void* aligned_alloc(size_t alignment, size_t size)
+    {
+        count();
+        return __libc_memalign(alignment, size);
+    }
+
+    __attribute__((visibility("default"))) int posix_memalign(void** out, size_t alignment, size_t size)
+    {
+        count();
+
+        void* block = __libc_memalign(alignment, size);
+
+        if (block == nullptr)
+            return 12; // ENOMEM
+
+        *out = block;
+        return 0;
+    }
+}
@@ -0,0 +1,1500 @@
+// Benchmark driver for the VST host bridge.
+//
+// Starts the host the same way a client does, speaks the VSTHostCommand
+// protocol over its stdin/stdout pipes and reports throughput, per-command
+// latency percentiles and heap allocations per command for a set of
+// scenarios. Each scenario runs against a fresh host process.
+//
+//   vsthost_bench [--host PATH] [--plugin PATH] [--scenario NAME]...
+//                 [--iterations N] [--frames N] [--events N] [--cost N]
+//                 [--open-ms N]
+//
+// The host defaults to the native one built next to the driver and the plugin
+// to the mock synth, whose cost is set with --cost and whose instantiation
+// time is set with --open-ms. When the allocation hook is available it is
+// preloaded into the host and allocations are reported per measured command.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <memory>
+#include <signal.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "audio_ring.h"
+#include "host_stats.h"
+
+namespace
+{
+    // Must match VSTHostCommand in host_engine.cpp.
+    enum class Command : uint32_t
+    {
+        Exit = 0,
+        GetChunk,
+        SetChunk,
+        HasEditor,
+        DisplayEditorModal,
+        SetSampleRate,
+        Reset,
+        SendMIDIEvent,
+        SendSysexEvent,
+        RenderSamples,
+        SendMIDIEventWithTimestamp,
+        SendSysexEventWithTimestamp,
+        MapAudioRing,
+        SendEventBatch,
+        SetParallelRender,
+        SetBlockSize,
+        SetOutputFormat,
+        GetStats,
+        RenderJob,
+        SetPipelineMode,
+        Sync,
+        SetInstancePool,
+        SoftReset,
+        SetPreroll,
+        SetSilenceSkipping,
+        SetInstanceCount,
+        SetLazyInstances,
+        SetPortFolding,
+        SetProcessPrecision,
+        SetOutputLayout,
+    };
+
+    struct Options
+    {
+        std::string host;
+        std::string plugin;
+        std::vector<std::string> scenarios;
+        unsigned iterations = 2000;
+        unsigned frames = 512;
+        unsigned events = 256;
+        unsigned cost = 16;
+        unsigned open_ms = 0;
+        bool need_idle = false;
+        unsigned idle_us = 0;
+        unsigned sample_kb = 0;
+        unsigned outputs = 2;
+    };
+
+    typedef std::chrono::steady_clock Clock;
+
+    double elapsed_us(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    }
+
+    [[noreturn]] void fail(const char* message)
+    {
+        fprintf(stderr, "vsthost_bench: %s\n", message);
+        exit(1);
+    }
+
+    class AllocCounter
+    {
+    public:
+        AllocCounter()
+        {
+#ifdef VSTHOST_ALLOC_HOOK
+            char path[] = "/tmp/vsthost-allocs-XXXXXX";
+
+            int fd = mkstemp(path);
+
+            if (fd < 0)
+                return;
+
+            if (ftruncate(fd, sizeof(uint64_t)) == 0)
+            {
+                void* view = mmap(nullptr, sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+                if (view != MAP_FAILED)
+                {
+                    counter = (std::atomic<uint64_t>*)view;
+                    file = path;
+                }
+            }
+
+            close(fd);
+#endif
+        }
+
+        ~AllocCounter()
+        {
+            if (counter)
+            {
+                munmap((void*)counter, sizeof(uint64_t));
+                unlink(file.c_str());
+            }
+        }
+
+        bool active() const { return counter != nullptr; }
+        const std::string& path() const { return file; }
+        uint64_t value() const { return counter ? counter->load(std::memory_order_relaxed) : 0; }
+
+    private:
+        std::atomic<uint64_t>* counter = nullptr;
+        std::string file;
+    };
+
+    class Host
+    {
+    public:
+        Host(const Options& options, const AllocCounter& allocs)
+        {
+            int to_host[2];
+            int from_host[2];
+
+            if (pipe(to_host) || pipe(from_host))
+                fail("cannot create pipes");
+
+            uint32_t cookie = 0;
+
+            for (const char* c = options.plugin.c_str(); *c; ++c)
+                cookie += *c * 820109;
+
+            char cookie_string[16];
+            snprintf(cookie_string, sizeof(cookie_string), "%x", cookie);
+
+            pid = fork();
+
+            if (pid < 0)
+                fail("cannot fork");
+
+            if (pid == 0)
+            {
+                dup2(to_host[0], 0);
+                dup2(from_host[1], 1);
+
+                close(to_host[0]);
+                close(to_host[1]);
+                close(from_host[0]);
+                close(from_host[1]);
+
+                setenv("VSTHOST_MOCK_COST", std::to_string(options.cost).c_str(), 0);
+                setenv("VSTHOST_MOCK_OPEN_MS", std::to_string(options.open_ms).c_str(), 0);
+                setenv("VSTHOST_MOCK_NEED_IDLE", options.need_idle ? "1" : "0", 0);
+                setenv("VSTHOST_MOCK_IDLE_US", std::to_string(options.idle_us).c_str(), 0);
+                setenv("VSTHOST_MOCK_SAMPLE_KB", std::to_string(options.sample_kb).c_str(), 0);
+                setenv("VSTHOST_MOCK_OUTPUTS", std::to_string(options.outputs).c_str(), 0);
+
+#ifdef VSTHOST_ALLOC_HOOK
+                if (allocs.active())
+                {
+                    setenv("LD_PRELOAD", VSTHOST_ALLOC_HOOK, 1);
+                    setenv("VSTHOST_ALLOC_COUNTER", allocs.path().c_str(), 1);
+                }
+#else
+                (void)allocs;
+#endif
+
+                execl(options.host.c_str(), options.host.c_str(), options.plugin.c_str(), cookie_string, (char*)nullptr);
+                _exit(127);
+            }
+
+            close(to_host[0]);
+            close(from_host[1]);
+
+            out = to_host[1];
+            in = from_host[0];
+
+            uint32_t code = get();
+
+            if (code != 0)
+            {
+                fprintf(stderr, "vsthost_bench: host failed to start with code %u\n", code);
+                exit(1);
+            }
+
+            uint32_t name_length = get();
+            uint32_t vendor_length = get();
+            uint32_t product_length = get();
+
+            get(); // vendor version
+            get(); // unique id
+
+            channels = get();
+
+            std::vector<char> strings(name_length + vendor_length + product_length);
+
+            read(strings.data(), strings.size());
+
+            name.assign(strings.data(), name_length);
+        }
+
+        ~Host()
+        {
+            put(Command::Exit);
+            get();
+
+            close(out);
+            close(in);
+
+            waitpid(pid, nullptr, 0);
+        }
+
+        void write(const void* data, size_t size)
+        {
+            const uint8_t* bytes = (const uint8_t*)data;
+
+            while (size)
+            {
+                ssize_t done = ::write(out, bytes, size);
+
+                if (done <= 0)
+                    fail("host closed its input");
+
+                bytes += done;
+                size -= (size_t)done;
+            }
+        }
+
+        void read(void* data, size_t size)
+        {
+            uint8_t* bytes = (uint8_t*)data;
+
+            while (size)
+            {
+                ssize_t done = ::read(in, bytes, size);
+
+                if (done <= 0)
+                    fail("host closed its output");
+
+                bytes += done;
+                size -= (size_t)done;
+            }
+        }
+
+        void put(uint32_t code)
+        {
+            write(&code, sizeof(code));
+        }
+
+        void put(Command command)
+        {
+            put((uint32_t)command);
+
+            if (ack_interval)
+                put(++sequence);
+        }
+
+        uint32_t get()
+        {
+            uint32_t code;
+            read(&code, sizeof(code));
+            return code;
+        }
+
+        void expect_ok()
+        {
+            if (get() != 0)
+                fail("command failed");
+
+            if (ack_interval)
+            {
+                if (get() != sequence)
+                    fail("acknowledgement out of sequence");
+
+                unacked = 0;
+            }
+        }
+
+        // Commands that return nothing are only acknowledged once every
+        // interval in pipelined mode.
+        void expect_ack()
+        {
+            if (ack_interval == 0 || ++unacked >= ack_interval)
+                expect_ok();
+        }
+
+        void set_pipeline(uint32_t interval)
+        {
+            put(Command::SetPipelineMode);
+            put(interval);
+            expect_ok();
+            get();
+
+            ack_interval = interval;
+            unacked = 0;
+        }
+
+        void send_midi(uint32_t word, uint32_t timestamp)
+        {
+            put(Command::SendMIDIEventWithTimestamp);
+            put(word);
+            put(timestamp);
+            expect_ack();
+        }
+
+        void send_batch(const std::vector<uint32_t>& records)
+        {
+            put(Command::SendEventBatch);
+            put((uint32_t)(records.size() * sizeof(uint32_t)));
+            write(records.data(), records.size() * sizeof(uint32_t));
+            expect_ack();
+        }
+
+        uint32_t set_value(Command command, uint32_t value)
+        {
+            put(command);
+            put(value);
+            expect_ok();
+            return get();
+        }
+
+        uint32_t set_block_size(uint32_t block_size)
+        {
+            put(Command::SetBlockSize);
+            put(sizeof(uint32_t));
+            put(block_size);
+            expect_ok();
+            return get();
+        }
+
+        void set_output_format(uint32_t format, uint32_t flags)
+        {
+            put(Command::SetOutputFormat);
+            put(format);
+            put(flags);
+            expect_ok();
+
+            sample_bytes = format == 3 ? 8 : format == 2 ? 2 : format == 1 ? 3 : 4;
+            get();
+        }
+
+        // Returns whether lazy instances are on.
+        bool set_lazy_instances(uint32_t enable, uint32_t idle_close_ms)
+        {
+            put(Command::SetLazyInstances);
+            put(enable);
+            put(idle_close_ms);
+            expect_ok();
+            return get() != 0;
+        }
+
+        // Plays port p on instance p / ports_per_instance, its channel c on
+        // channel c + (p % ports_per_instance) * 16 / ports_per_instance.
+        // Returns the number of ports folded.
+        uint32_t fold_ports(uint32_t ports, uint32_t ports_per_instance)
+        {
+            put(Command::SetPortFolding);
+            put(ports);
+
+            for (uint32_t port = 0; port < ports; ++port)
+            {
+                uint8_t channels[16];
+
+                for (uint32_t channel = 0; channel < 16; ++channel)
+                    channels[channel] = (uint8_t)((channel + (port % ports_per_instance) * 16 / ports_per_instance) & 15);
+
+                put(port / ports_per_instance);
+                write(channels, sizeof(channels));
+            }
+
+            expect_ok();
+
+            uint32_t folded = get();
+            get(); // MIDI channels of the plugin
+
+            return folded;
+        }
+
+        // Returns the layout in effect, the channels of a reply frame follow it.
+        uint32_t set_output_layout(uint32_t flags)
+        {
+            put(Command::SetOutputLayout);
+            put(flags);
+            expect_ok();
+
+            uint32_t layout = get();
+            channels = get();
+
+            return layout;
+        }
+
+        // Returns whether the pre-roll was started in the background.
+        bool set_preroll(uint32_t frames, uint32_t silent_blocks, uint32_t flags)
+        {
+            put(Command::SetPreroll);
+            put(frames);
+            put(silent_blocks);
+            put(flags);
+            expect_ok();
+            return get() != 0;
+        }
+
+        bool map_ring(uint32_t frames)
+        {
+            put(Command::MapAudioRing);
+            put(frames);
+            expect_ok();
+
+            uint32_t name_length = get();
+            uint32_t capacity = get();
+
+            std::string ring_name(name_length, '\0');
+            read(ring_name.data(), name_length);
+
+            if (!name_length)
+                return false;
+
+            int fd = shm_open(ring_name.c_str(), O_RDWR, 0);
+
+            if (fd < 0)
+                return false;
+
+            ring_size = ((sizeof(AudioRingHeader) + 63) & ~size_t(63)) + capacity;
+            ring = (AudioRingHeader*)mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+            close(fd);
+
+            return ring != MAP_FAILED;
+        }
+
+        // Resident set of the host process, in KiB.
+        unsigned resident_kb()
+        {
+            char path[64];
+            snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+
+            FILE* f = fopen(path, "r");
+
+            if (f == nullptr)
+                return 0;
+
+            char line[256];
+            unsigned kb = 0;
+
+            while (fgets(line, sizeof(line), f))
+            {
+                if (sscanf(line, "VmRSS: %u kB", &kb) == 1)
+                    break;
+            }
+
+            fclose(f);
+
+            return kb;
+        }
+
+        void get_stats(bool reset, std::vector<uint8_t>& stats)
+        {
+            put(Command::GetStats);
+            put(reset ? 1u : 0u);
+            expect_ok();
+
+            stats.resize(get());
+            read(stats.data(), stats.size());
+        }
+
+        void render(uint32_t frames)
+        {
+            put(Command::RenderSamples);
+            put(frames);
+            expect_ok();
+
+            receive(frames);
+        }
+
+        // One message carrying the events and the frame count, answered by
+        // the audio alone, followed by the acknowledgement in pipelined mode.
+        void render_job(const std::vector<uint32_t>& records, uint32_t frames)
+        {
+            put(Command::RenderJob);
+            put(frames);
+            put((uint32_t)(records.size() * sizeof(uint32_t)));
+            write(records.data(), records.size() * sizeof(uint32_t));
+
+            receive(frames);
+
+            if (ack_interval)
+                expect_ok();
+        }
+
+        void receive(uint32_t frames)
+        {
+            size_t frame_bytes = (size_t)channels * sample_bytes;
+
+            if (ring == nullptr)
+            {
+                buffer.resize(frames * frame_bytes);
+                read(buffer.data(), buffer.size());
+                return;
+            }
+
+            const uint8_t* data = (const uint8_t*)ring + ring->data_offset;
+
+            buffer.resize(frames * frame_bytes);
+
+            for (uint32_t received = 0; received < frames;)
+            {
+                uint32_t ready = get();
+                uint32_t size = (uint32_t)(ready * frame_bytes);
+
+                uint64_t position = ring->read_position.load(std::memory_order_relaxed);
+                uint32_t offset = (uint32_t)(position % ring->capacity);
+                uint32_t first = std::min(size, ring->capacity - offset);
+
+                memcpy(buffer.data() + received * frame_bytes, data + offset, first);
+                memcpy(buffer.data() + received * frame_bytes + first, data, size - first);
+
+                ring->read_position.store(position + size, std::memory_order_release);
+
+                received += ready;
+            }
+        }
+
+        // Level of the audio the last render returned, in float output.
+        double rms() const
+        {
+            size_t count = buffer.size() / sizeof(float);
+
+            if (count == 0)
+                return 0.0;
+
+            double sum = 0.0;
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                float sample;
+                memcpy(&sample, &buffer[i * sizeof(float)], sizeof(sample));
+                sum += (double)sample * sample;
+            }
+
+            return std::sqrt(sum / (double)count);
+        }
+
+        std::string name;
+        uint32_t channels = 0;
+
+    private:
+        pid_t pid = -1;
+        int out = -1;
+        int in = -1;
+
+        uint32_t ack_interval = 0;
+        uint32_t sequence = 0;
+        uint32_t unacked = 0;
+
+        uint32_t sample_bytes = 4;
+        AudioRingHeader* ring = nullptr;
+        size_t ring_size = 0;
+        std::vector<uint8_t> buffer;
+    };
+
+    struct Latency
+    {
+        std::vector<double> samples;
+
+        void add(double us)
+        {
+            samples.push_back(us);
+        }
+
+        double percentile(double q)
+        {
+            if (samples.empty())
+                return 0.0;
+
+            std::sort(samples.begin(), samples.end());
+
+            size_t index = std::min(samples.size() - 1, (size_t)(q * (double)samples.size()));
+
+            return samples[index];
+        }
+
+        double total() const
+        {
+            double sum = 0.0;
+
+            for (double sample : samples)
+                sum += sample;
+
+            return sum;
+        }
+    };
+
+    // Runs `iterations` timed calls of `op`, each handling `frames` frames of audio.
+    struct Measurement
+    {
+        Latency latency;
+        double frames = 0.0;
+        uint64_t allocations = 0;
+        unsigned count = 0;
+    };
+
+    // `idle`, if given, runs untimed after every call.
+    Measurement measure(const AllocCounter& allocs, unsigned iterations, double frames_per_op, const std::function<void()>& op, const std::function<void()>& idle = nullptr)
+    {
+        Measurement result;
+
+        uint64_t allocs_before = allocs.value();
+
+        for (unsigned i = 0; i < iterations; ++i)
+        {
+            auto start = Clock::now();
+
+            op();
+
+            result.latency.add(elapsed_us(start));
+
+            if (idle)
+                idle();
+        }
+
+        result.allocations = allocs.value() - allocs_before;
+        result.frames = frames_per_op * iterations;
+        result.count = iterations;
+
+        return result;
+    }
+
+    void print_header()
+    {
+        printf("%-24s %12s %10s %10s %10s %10s %12s\n", "scenario", "frames/s", "p50 us", "p90 us", "p99 us", "max us", "allocs/op");
+    }
+
+    void report(const char* name, Measurement& m, const AllocCounter& allocs)
+    {
+        double seconds = m.latency.total() / 1e6;
+        double frames_per_second = seconds > 0.0 ? m.frames / seconds : 0.0;
+
+        char allocs_string[32] = "n/a";
+
+        if (allocs.active() && m.count)
+            snprintf(allocs_string, sizeof(allocs_string), "%.2f", (double)m.allocations / m.count);
+
+        printf("%-24s %12.0f %10.1f %10.1f %10.1f %10.1f %12s\n", name, frames_per_second, m.latency.percentile(0.5), m.latency.percentile(0.9), m.latency.percentile(0.99), m.latency.percentile(1.0), allocs_string);
+        fflush(stdout);
+    }
+
+    // The first render instantiates the secondary instances and runs the
+    // pre-roll, it is kept out of every measurement.
+    void warm_up(Host& host, unsigned frames)
+    {
+        host.render(frames);
+        host.render(frames);
+    }
+
+    uint32_t cc_event(unsigned i)
+    {
+        return 0xB0u | ((i & 15u) << 0) | ((i % 120u) << 8) | ((i * 7u & 127u) << 16);
+    }
+
+    void scenario_render(const Options& options, const AllocCounter& allocs, const char* name, const std::function<void(Host&)>& setup)
+    {
+        Host host(options, allocs);
+
+        if (setup)
+            setup(host);
+
+        warm_up(host, options.frames);
+
+        Measurement m = measure(allocs, options.iterations, options.frames, [&] { host.render(options.frames); });
+
+        report(name, m, allocs);
+    }
+
+    enum class EventDelivery
+    {
+        PerEvent,
+        Batch,
+        Job,
+        Pipelined
+    };
+
+    enum
+    {
+        BENCH_ACK_INTERVAL = 64
+    };
+
+    void scenario_dense_midi(const Options& options, const AllocCounter& allocs, EventDelivery delivery)
+    {
+        Host host(options, allocs);
+
+        if (delivery == EventDelivery::Pipelined)
+            host.set_pipeline(BENCH_ACK_INTERVAL);
+
+        warm_up(host, options.frames);
+
+        std::vector<uint32_t> records;
+
+        Measurement m = measure(allocs, options.iterations, options.frames, [&]
+            {
+                if (delivery == EventDelivery::PerEvent || delivery == EventDelivery::Pipelined)
+                {
+                    for (unsigned i = 0; i < options.events; ++i)
+                        host.send_midi(cc_event(i), i * options.frames / options.events);
+
+                    host.render(options.frames);
+                    return;
+                }
+
+                records.clear();
+
+                for (unsigned i = 0; i < options.events; ++i)
+                {
+                    records.push_back(cc_event(i));
+                    records.push_back(i * options.frames / options.events);
+                }
+
+                if (delivery == EventDelivery::Batch)
+                {
+                    host.send_batch(records);
+                    host.render(options.frames);
+                }
+                else
+                    host.render_job(records, options.frames);
+            });
+
+        static const char* const names[] = { "dense-midi", "dense-midi-batch", "dense-midi-job", "dense-midi-pipelined" };
+
+        unsigned round_trips = 1;
+
+        if (delivery == EventDelivery::PerEvent)
+            round_trips = options.events + 1;
+        else if (delivery == EventDelivery::Batch)
+            round_trips = 2;
+        else if (delivery == EventDelivery::Pipelined)
+            round_trips = options.events / BENCH_ACK_INTERVAL + 1;
+
+        report(names[(int)delivery], m, allocs);
+
+        double seconds = m.latency.total() / 1e6;
+
+        printf("%-24s %12.0f events/s, %u round trips/period\n", "", seconds > 0.0 ? (double)options.events * m.count / seconds : 0.0, round_trips);
+    }
+
+    void scenario_chunk(const Options& options, const AllocCounter& allocs)
+    {
+        Host host(options, allocs);
+
+        warm_up(host, options.frames);
+
+        std::vector<uint8_t> chunk;
+
+        Measurement m = measure(allocs, options.iterations / 4 + 1, 0.0, [&]
+            {
+                host.put(Command::GetChunk);
+                host.expect_ok();
+
+                chunk.resize(host.get());
+                host.read(chunk.data(), chunk.size());
+
+                host.put(Command::SetChunk);
+                host.put((uint32_t)chunk.size());
+                host.write(chunk.data(), chunk.size());
+                host.expect_ack();
+            });
+
+        report("chunk-roundtrip", m, allocs);
+    }
+
+    enum class ResetKind
+    {
+        Full,
+        Pooled,
+        Soft,
+        SoftCycleMains,
+    };
+
+    // Resets are spaced like the ones between songs, which leaves the
+    // instance pool time to refill.
+    void scenario_reset(const Options& options, const AllocCounter& allocs, ResetKind kind)
+    {
+        static const char* const names[] = { "reset+render", "reset+render-pooled", "soft-reset+render", "soft-reset+render-mains" };
+
+        Host host(options, allocs);
+
+        if (kind == ResetKind::Pooled && !host.set_value(Command::SetInstancePool, 1))
+            fail("instance pool refused");
+
+        warm_up(host, options.frames);
+
+        unsigned pause_ms = options.open_ms * 4 + 20;
+
+        usleep(pause_ms * 1000);
+
+        Measurement m = measure(allocs, options.iterations / 20 + 1, options.frames, [&]
+            {
+                if (kind == ResetKind::Soft || kind == ResetKind::SoftCycleMains)
+                {
+                    host.put(Command::SoftReset);
+                    host.put(kind == ResetKind::SoftCycleMains ? 1u : 0u);
+                }
+                else
+                    host.put(Command::Reset);
+
+                host.expect_ack();
+
+                host.render(options.frames);
+            },
+            [&] { usleep(pause_ms * 1000); });
+
+        report(names[(int)kind], m, allocs);
+    }
+
+    enum class PrerollMode
+    {
+        Fixed,
+        UntilSilent,
+        Background,
+    };
+
+    // Time of the first render of an idle-driven plugin, each on a fresh
+    // host. The background pre-roll is given a pause like a client loading
+    // its song would.
+    void scenario_preroll(const Options& options, const AllocCounter& allocs, PrerollMode mode)
+    {
+        static const char* const names[] = { "first-render-preroll", "first-render-silent", "first-render-background" };
+
+        Options idle = options;
+        idle.need_idle = true;
+
+        std::unique_ptr<Host> host;
+
+        auto start_host = [&]
+        {
+            host.reset();
+            host = std::make_unique<Host>(idle, allocs);
+
+            if (mode == PrerollMode::UntilSilent)
+                host->set_preroll(4096 * 200, 4, 0);
+            else if (mode == PrerollMode::Background)
+            {
+                host->set_preroll(4096 * 200, 0, 1);
+                usleep(500 * 1000);
+            }
+        };
+
+        start_host();
+
+        Measurement m = measure(allocs, options.iterations / 250 + 1, options.frames, [&] { host->render(options.frames); }, start_host);
+
+        report(names[(int)mode], m, allocs);
+    }
+
+    // Time of the render that brings the first event for port 1, on a fresh
+    // lazy host that already plays port 0, so the instance of port 1 is
+    // opened while the stream runs. The note on port 1 has to be heard
+    // afterwards, the audio it took is reported.
+    void scenario_new_port(const Options& options, const AllocCounter& allocs, PrerollMode mode)
+    {
+        static const char* const names[] = { "new-port-preroll", "new-port-silent", "new-port-background" };
+
+        enum
+        {
+            MAX_RENDERS_UNTIL_HEARD = 20000
+        };
+
+        Options idle = options;
+        idle.need_idle = true;
+
+        std::unique_ptr<Host> host;
+        double level = 0.0; // port 0 alone
+        unsigned max_frames_until_heard = 0;
+
+        auto start_host = [&]
+        {
+            host.reset();
+            host = std::make_unique<Host>(idle, allocs);
+
+            host->set_lazy_instances(1, 0);
+
+            if (mode == PrerollMode::UntilSilent)
+                host->set_preroll(4096 * 200, 4, 0);
+            else if (mode == PrerollMode::Background)
+                host->set_preroll(4096 * 200, 0, 1);
+
+            host->send_midi(0x00643C90, 0);
+            warm_up(*host, options.frames);
+
+            level = host->rms();
+        };
+
+        // A second note at another pitch raises the level by about half.
+        auto expect_heard = [&]
+        {
+            unsigned frames = options.frames;
+
+            for (unsigned i = 0; host->rms() < level * 1.2; ++i)
+            {
+                if (i == MAX_RENDERS_UNTIL_HEARD)
+                    fail("the note on the new port was not heard");
+
+                host->render(options.frames);
+                frames += options.frames;
+            }
+
+            max_frames_until_heard = std::max(max_frames_until_heard, frames);
+        };
+
+        start_host();
+
+        Measurement m = measure(allocs, options.iterations / 250 + 1, options.frames, [&]
+            {
+                host->send_midi(0x01644090, 0);
+                host->render(options.frames);
+            },
+            [&]
+            {
+                expect_heard();
+                start_host();
+            });
+
+        report(names[(int)mode], m, allocs);
+
+        printf("%-24s %12u frames until the note is heard, at most\n", "", max_frames_until_heard);
+    }
+
+    // One note held on port 0 while ports 1 and 2 get nothing, the common
+    // case of a single-port MIDI file.
+    void scenario_one_port(const Options& options, const AllocCounter& allocs, uint32_t skipping)
+    {
+        Host host(options, allocs);
+
+        if (skipping && !host.set_value(Command::SetSilenceSkipping, skipping))
+            fail("silence skipping refused");
+
+        host.send_midi(0x00643C90, 0); // note on, channel 1, middle C
+
+        // long enough for the silent instances to fall asleep
+        for (unsigned i = 0; i < 128; ++i)
+            host.render(options.frames);
+
+        Measurement m = measure(allocs, options.iterations, options.frames, [&] { host.render(options.frames); });
+
+        report(skipping ? "one-port-skip-silent" : "one-port", m, allocs);
+    }
+
+    // Every port plays a note, so each instance renders and is mixed.
+    void scenario_instances(const Options& options, const AllocCounter& allocs, uint32_t count)
+    {
+        Host host(options, allocs);
+
+        if (host.set_value(Command::SetInstanceCount, count) != count)
+            fail("instance count refused");
+
+        for (uint32_t port = 0; port < count; ++port)
+            host.send_midi(0x00643C90 | (port << 24) | ((port & 15) << 8), 0);
+
+        warm_up(host, options.frames);
+
+        Measurement m = measure(allocs, options.iterations, options.frames, [&] { host.render(options.frames); });
+
+        char name[32];
+        snprintf(name, sizeof(name), "instances-%u", count);
+
+        report(name, m, allocs);
+
+        printf("%-24s %12u KiB resident\n", "", host.resident_kb());
+    }
+
+    enum class LazyMode
+    {
+        Eager,
+        Lazy,
+        LazyIdleClose
+    };
+
+    // Only port 0 gets events while 16 instances are configured, each
+    // loading samples on effOpen. Times the first render on a fresh host,
+    // then reports what stays resident after a while of playing. With the
+    // idle close, port 1 plays one short note that is long over by then.
+    void scenario_lazy(const Options& options, const AllocCounter& allocs, LazyMode mode)
+    {
+        static const char* const names[] = { "first-render-eager", "first-render-lazy", "first-render-lazy-close" };
+
+        Options loading = options;
+        loading.open_ms = std::max(options.open_ms, 20u);
+        loading.sample_kb = 8192;
+
+        std::unique_ptr<Host> host;
+
+        auto start_host = [&]
+        {
+            host.reset();
+            host = std::make_unique<Host>(loading, allocs);
+
+            if (host->set_value(Command::SetInstanceCount, 16) != 16)
+                fail("instance count refused");
+
+            host->set_lazy_instances(mode != LazyMode::Eager, mode == LazyMode::LazyIdleClose ? 100 : 0);
+            host->send_midi(0x00643C90, 0);
+        };
+
+        start_host();
+
+        Measurement m = measure(allocs, options.iterations / 250 + 1, options.frames, [&] { host->render(options.frames); }, start_host);
+
+        report(names[(int)mode], m, allocs);
+
+        host->send_midi(0x01643C90, 0);
+        host->send_midi(0x01003C80, 64);
+
+        // about half a second of audio at the default rate and block size
+        for (unsigned i = 0; i < 48; ++i)
+            host->render(options.frames);
+
+        printf("%-24s %12u KiB resident\n", "", host->resident_kb());
+    }
+
+    // Value of one counter in a GetStats payload, see host_stats.h.
+    uint64_t stats_counter(const std::vector<uint8_t>& stats, StatsCounter id)
+    {
+        enum
+        {
+            HISTOGRAM_RECORD_SIZE = 4 * 2 + 8 * 6,
+            COUNTER_RECORD_SIZE = 4 + 8
+        };
+
+        uint32_t histograms = 0;
+        uint32_t counters = 0;
+
+        if (stats.size() < 8)
+            return 0;
+
+        memcpy(&histograms, &stats[4], 4);
+
+        size_t offset = 8 + (size_t)histograms * HISTOGRAM_RECORD_SIZE;
+
+        if (offset + 4 > stats.size())
+            return 0;
+
+        memcpy(&counters, &stats[offset], 4);
+        offset += 4;
+
+        for (uint32_t i = 0; i < counters && offset + COUNTER_RECORD_SIZE <= stats.size(); ++i, offset += COUNTER_RECORD_SIZE)
+        {
+            uint32_t counter_id;
+            uint64_t value;
+
+            memcpy(&counter_id, &stats[offset], 4);
+            memcpy(&value, &stats[offset + 4], 8);
+
+            if (counter_id == (uint32_t)id)
+                return value;
+        }
+
+        return 0;
+    }
+
+    // Eight ports with two notes each, on channels 1 and 2, each instance
+    // loading samples on effOpen. Folded, four ports share an instance.
+    void scenario_fold(const Options& options, const AllocCounter& allocs, bool fold)
+    {
+        enum
+        {
+            PORTS = 8,
+            PORTS_PER_INSTANCE = 4
+        };
+
+        Options loading = options;
+        loading.sample_kb = 8192;
+
+        Host host(loading, allocs);
+
+        if (host.set_value(Command::SetInstanceCount, PORTS) != PORTS)
+            fail("instance count refused");
+
+        if (fold && host.fold_ports(PORTS, PORTS_PER_INSTANCE) == 0)
+            fail("port folding refused");
+
+        for (uint32_t port = 0; port < PORTS; ++port)
+        {
+            host.send_midi(0x00643C90 | (port << 24), 0);
+            host.send_midi(0x00644391 | (port << 24), 0);
+        }
+
+        warm_up(host, options.frames);
+
+        std::vector<uint8_t> stats;
+        host.get_stats(true, stats);
+
+        Measurement m = measure(allocs, options.iterations, options.frames, [&] { host.render(options.frames); });
+
+        report(fold ? "ports-8-folded" : "ports-8", m, allocs);
+
+        host.get_stats(false, stats);
+
+        printf("%-24s %12u KiB resident, %llu instances folded away, %.1f ms of rendering saved\n", "", host.resident_kb(), (unsigned long long)stats_counter(stats, StatsCounter::InstancesFoldedAway), stats_counter(stats, StatsCounter::FoldSavedNs) / 1e6);
+    }
+
+    void scenario_block_sweep(const Options& options, const AllocCounter& allocs)
+    {
+        for (uint32_t block_size = 64; block_size <= 8192; block_size *= 2)
+        {
+            Host host(options, allocs);
+
+            host.set_block_size(block_size);
+
+            warm_up(host, block_size);
+
+            unsigned iterations = std::max(16u, (unsigned)((uint64_t)options.iterations * options.frames / block_size));
+
+            Measurement m = measure(allocs, iterations, block_size, [&] { host.render(block_size); });
+
+            char name[32];
+            snprintf(name, sizeof(name), "block-%u", block_size);
+
+            report(name, m, allocs);
+        }
+    }
+
+    // Renders with a steady event load, then prints where the host says the
+    // time went according to its own histograms.
+    void scenario_stats(const Options& options, const AllocCounter& allocs)
+    {
+        Host host(options, allocs);
+
+        warm_up(host, options.frames);
+
+        std::vector<uint8_t> stats;
+        host.get_stats(true, stats);
+
+        std::vector<uint32_t> records;
+
+        Measurement m = measure(allocs, options.iterations, options.frames, [&]
+            {
+                records.clear();
+
+                for (unsigned i = 0; i < options.events; ++i)
+                {
+                    records.push_back(cc_event(i));
+                    records.push_back(i * options.frames / options.events);
+                }
+
+                host.send_batch(records);
+                host.render(options.frames);
+            });
+
+        report("stats", m, allocs);
+
+        host.get_stats(false, stats);
+
+        const uint8_t* in = stats.data();
+        const uint8_t* end = in + stats.size();
+
+        auto take32 = [&]
+        {
+            uint32_t value = 0;
+
+            if (end - in >= 4)
+                memcpy(&value, in, 4);
+
+            in += 4;
+            return value;
+        };
+
+        auto take64 = [&]
+        {
+            uint64_t value = 0;
+
+            if (end - in >= 8)
+                memcpy(&value, in, 8);
+
+            in += 8;
+            return value;
+        };
+
+        static const char* const kinds[] = { "command", "instance", "stage" };
+        static const char* const stages[] = { "event-dispatch", "mixdown", "output-write", "preroll", "idle" };
+        static const char* const counters[] = { "events-queued", "events-dropped", "arena-peak-bytes", "arena-reserved-bytes", "frames-rendered", "instances-created", "instances-from-pool", "instance-pool-failures", "preroll-frames", "instances-open", "instances-closed-idle", "ports-folded", "instances-folded-away", "fold-saved-ns" };
+
+        if (take32() != HostStats::VERSION)
+            fail("unexpected stats version");
+
+        uint32_t histograms = take32();
+
+        printf("  %-10s %-16s %10s %12s %10s %10s %10s %10s\n", "kind", "id", "count", "total us", "p50 us", "p90 us", "p99 us", "max us");
+
+        for (uint32_t i = 0; i < histograms && in < end; ++i)
+        {
+            uint32_t kind = take32();
+            uint32_t id = take32();
+            uint64_t count = take64();
+            uint64_t total = take64();
+            uint64_t max = take64();
+            uint64_t p50 = take64();
+            uint64_t p90 = take64();
+            uint64_t p99 = take64();
+
+            char id_string[32];
+
+            if (kind == (uint32_t)StatsKind::Stage && id < sizeof(stages) / sizeof(stages[0]))
+                snprintf(id_string, sizeof(id_string), "%s", stages[id]);
+            else
+                snprintf(id_string, sizeof(id_string), "%u", id);
+
+            printf("  %-10s %-16s %10llu %12.1f %10.1f %10.1f %10.1f %10.1f\n", kind < 3 ? kinds[kind] : "?", id_string, (unsigned long long)count, total / 1e3, p50 / 1e3, p90 / 1e3, p99 / 1e3, max / 1e3);
+        }
+
+        uint32_t counter_count = take32();
+
+        for (uint32_t i = 0; i < counter_count && in < end; ++i)
+        {
+            uint32_t id = take32();
+            uint64_t value = take64();
+
+            printf("  %-27s %10llu\n", id < sizeof(counters) / sizeof(counters[0]) ? counters[id] : "?", (unsigned long long)value);
+        }
+
+        uint32_t instance_count = take32();
+
+        if (instance_count)
+            printf("  %-10s %16s %16s %12s\n", "instance", "frames rendered", "frames skipped", "saved us");
+
+        for (uint32_t i = 0; i < instance_count && in < end; ++i)
+        {
+            uint32_t index = take32();
+            uint64_t rendered = take64();
+            uint64_t skipped = take64();
+            uint64_t saved = take64();
+
+            printf("  %-10u %16llu %16llu %12.1f\n", index, (unsigned long long)rendered, (unsigned long long)skipped, saved / 1e3);
+        }
+
+        fflush(stdout);
+    }
+
+    void run_scenario(const std::string& name, const Options& options, const AllocCounter& allocs)
+    {
+        if (name == "render")
+            scenario_render(options, allocs, "render", nullptr);
+        else if (name == "render-ring")
+            scenario_render(options, allocs, "render-ring", [&](Host& host)
+                {
+                    if (!host.map_ring(options.frames * 4))
+                        fail("cannot map the audio ring");
+                });
+        else if (name == "render-int16")
+            scenario_render(options, allocs, "render-int16", [](Host& host) { host.set_output_format(2, 1); });
+        else if (name == "parallel")
+        {
+            Options heavy = options;
+            heavy.cost = std::max(options.cost, 256u);
+
+            scenario_render(heavy, allocs, "serial-heavy", nullptr);
+            scenario_render(heavy, allocs, "parallel-heavy", [](Host& host)
+                {
+                    if (!host.set_value(Command::SetParallelRender, 1))
+                        fail("parallel rendering refused");
+                });
+        }
+        else if (name == "dense-midi")
+        {
+            scenario_dense_midi(options, allocs, EventDelivery::PerEvent);
+            scenario_dense_midi(options, allocs, EventDelivery::Batch);
+            scenario_dense_midi(options, allocs, EventDelivery::Job);
+            scenario_dense_midi(options, allocs, EventDelivery::Pipelined);
+        }
+        else if (name == "chunk")
+            scenario_chunk(options, allocs);
+        else if (name == "reset")
+        {
+            Options slow = options;
+            slow.open_ms = std::max(options.open_ms, 20u);
+
+            scenario_reset(slow, allocs, ResetKind::Full);
+            scenario_reset(slow, allocs, ResetKind::Pooled);
+            scenario_reset(slow, allocs, ResetKind::Soft);
+            scenario_reset(slow, allocs, ResetKind::SoftCycleMains);
+        }
+        else if (name == "render-idle")
+        {
+            // A plugin that wants idle calls and spends 200 us in each of them.
+            Options idle = options;
+            idle.need_idle = true;
+            idle.idle_us = 200;
+
+            scenario_render(idle, allocs, "render-idle", [](Host& host) { host.set_preroll(0, 0, 0); });
+        }
+        else if (name == "instances")
+        {
+            for (uint32_t count : { 1u, 3u, 8u, 16u })
+                scenario_instances(options, allocs, count);
+        }
+        else if (name == "lazy")
+        {
+            scenario_lazy(options, allocs, LazyMode::Eager);
+            scenario_lazy(options, allocs, LazyMode::Lazy);
+            scenario_lazy(options, allocs, LazyMode::LazyIdleClose);
+        }
+        else if (name == "fold")
+        {
+            scenario_fold(options, allocs, false);
+            scenario_fold(options, allocs, true);
+        }
+        else if (name == "precision")
+        {
+            // All three instances render, none is opened lazily.
+            auto doubled = [](Host& host)
+            {
+                if (host.set_value(Command::SetProcessPrecision, 1) != 1)
+                    fail("double precision refused");
+            };
+
+            scenario_render(options, allocs, "render-f32", nullptr);
+            scenario_render(options, allocs, "render-f64", doubled);
+            scenario_render(options, allocs, "render-f64-int24", [&](Host& host)
+                {
+                    doubled(host);
+                    host.set_output_format(1, 1);
+                });
+            scenario_render(options, allocs, "render-f64-out-f64", [&](Host& host)
+                {
+                    doubled(host);
+                    host.set_output_format(3, 0);
+                });
+        }
+        else if (name == "layout")
+        {
+            // A 5.1 synth on three ports, each playing a note.
+            Options surround = options;
+            surround.outputs = 6;
+
+            static const struct
+            {
+                const char* name;
+                uint32_t flags;
+            } layouts[] = {
+                { "layout-stereo", 0 },
+                { "layout-surround", 1 },
+                { "layout-surround-planar", 1 | 4 },
+                { "layout-stems", 2 },
+                { "layout-stems-planar", 2 | 4 },
+            };
+
+            for (const auto& layout : layouts)
+            {
+                scenario_render(surround, allocs, layout.name, [&](Host& host)
+                    {
+                        if (host.set_output_layout(layout.flags) != (layout.flags | (layout.flags & 2 ? 1u : 0u)))
+                            fail("output layout refused");
+
+                        for (uint32_t port = 0; port < 3; ++port)
+                            host.send_midi(0x00643C90 | (port << 24), 0);
+                    });
+            }
+        }
+        else if (name == "silence")
+        {
+            scenario_one_port(options, allocs, 0);
+            scenario_one_port(options, allocs, 2);
+        }
+        else if (name == "preroll")
+        {
+            scenario_preroll(options, allocs, PrerollMode::Fixed);
+            scenario_preroll(options, allocs, PrerollMode::UntilSilent);
+            scenario_preroll(options, allocs, PrerollMode::Background);
+            scenario_new_port(options, allocs, PrerollMode::Fixed);
+            scenario_new_port(options, allocs, PrerollMode::UntilSilent);
+            scenario_new_port(options, allocs, PrerollMode::Background);
+        }
+        else if (name == "block-sweep")
+            scenario_block_sweep(options, allocs);
+        else if (name == "stats")
+            scenario_stats(options, allocs);
+        else
+        {
+            fprintf(stderr, "vsthost_bench: unknown scenario '%s'\n", name.c_str());
+            exit(1);
+        }
+    }
+
+    const char* const all_scenarios[] = {
+        "render",
+        "render-ring",
+        "render-int16",
+        "render-idle",
+        "parallel",
+        "dense-midi",
+        "chunk",
+        "reset",
+        "preroll",
+        "silence",
+        "instances",
+        "lazy",
+        "fold",
+        "precision",
+        "layout",
+        "block-sweep",
+        "stats",
+    };
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+
+#ifdef VSTHOST_MOCK_SYNTH
+    options.plugin = VSTHOST_MOCK_SYNTH;
+#endif
+#ifdef VSTHOST_HOST
+    options.host = VSTHOST_HOST;
+#endif
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+
+        if (i + 1 >= argc)
+        {
+            fprintf(stderr, "vsthost_bench: missing value for %s\n", arg.c_str());
+            return 1;
+        }
+
+        std::string value = argv[++i];
+
+        if (arg == "--host")
+            options.host = value;
+        else if (arg == "--plugin")
+            options.plugin = value;
+        else if (arg == "--scenario")
+            options.scenarios.push_back(value);
+        else if (arg == "--iterations")
+            options.iterations = (unsigned)std::stoul(value);
+        else if (arg == "--frames")
+            options.frames = (unsigned)std::stoul(value);
+        else if (arg == "--events")
+            options.events = (unsigned)std::stoul(value);
+        else if (arg == "--open-ms")
+            options.open_ms = (unsigned)std::stoul(value);
+        else if (arg == "--cost")
+            options.cost = (unsigned)std::stoul(value);
+        else
+        {
+            fprintf(stderr, "vsthost_bench: unknown option %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    if (options.host.empty() || options.plugin.empty())
+    {
+        fprintf(stderr, "usage: vsthost_bench [--host PATH] [--plugin PATH] [--scenario NAME]... [--iterations N] [--frames N] [--events N] [--cost N] [--open-ms N]\n");
+        return 1;
+    }
+
+    if (options.scenarios.empty() || options.scenarios[0] == "all")
+        options.scenarios.assign(std::begin(all_scenarios), std::end(all_scenarios));
+
+    signal(SIGPIPE, SIG_IGN);
+
+    AllocCounter allocs;
+
+    print_header();
+
+    for (const std::string& scenario : options.scenarios)
+        run_scenario(scenario, options, allocs);
+
+    return 0;
+}
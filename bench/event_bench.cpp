@@ -0,0 +1,147 @@
+// Per-render event overhead: the original linked list with calloc'd nodes,
+// a counting pass and one malloc'd VstEvents per port, against the arena
+// and the per-port VstEventList the host uses now.
+
+#include "event_arena.h"
+#include "event_list.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    const unsigned PORTS = 3;
+
+    struct ListEvent
+    {
+        ListEvent* next;
+        unsigned port;
+        VstMidiEvent midiEvent;
+    };
+
+    // Sink standing in for effProcessEvents, so nothing is optimised away.
+    volatile VstInt32 dispatched = 0;
+
+    void dispatch(VstEvents* events)
+    {
+        dispatched = dispatched + events->numEvents + events->events[0]->type;
+    }
+
+    double bench_list(unsigned events, unsigned renders)
+    {
+        auto start = Clock::now();
+
+        for (unsigned render = 0; render < renders; ++render)
+        {
+            ListEvent* head = nullptr;
+            ListEvent* tail = nullptr;
+
+            for (unsigned i = 0; i < events; ++i)
+            {
+                ListEvent* ev = (ListEvent*)calloc(sizeof(ListEvent), 1);
+
+                if (tail)
+                    tail->next = ev;
+
+                tail = ev;
+
+                if (!head)
+                    head = ev;
+
+                ev->port = i % PORTS;
+                ev->midiEvent.type = kVstMidiType;
+                ev->midiEvent.byteSize = sizeof(ev->midiEvent);
+            }
+
+            unsigned count[PORTS] = {};
+
+            for (ListEvent* ev = head; ev; ev = ev->next)
+                count[ev->port]++;
+
+            for (unsigned port = 0; port < PORTS; ++port)
+            {
+                if (!count[port])
+                    continue;
+
+                VstEvents* list = (VstEvents*)malloc(offsetof(VstEvents, events) + sizeof(VstEvent*) * count[port]);
+
+                list->numEvents = (VstInt32)count[port];
+                list->reserved = 0;
+
+                unsigned n = 0;
+
+                for (ListEvent* ev = head; ev; ev = ev->next)
+                {
+                    if (ev->port == port)
+                        list->events[n++] = (VstEvent*)&ev->midiEvent;
+                }
+
+                dispatch(list);
+                free(list);
+            }
+
+            while (head)
+            {
+                ListEvent* next = head->next;
+                free(head);
+                head = next;
+            }
+        }
+
+        return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / renders;
+    }
+
+    double bench_buckets(unsigned events, unsigned renders)
+    {
+        EventArena arena;
+        VstEventList lists[PORTS];
+
+        auto start = Clock::now();
+
+        for (unsigned render = 0; render < renders; ++render)
+        {
+            for (unsigned i = 0; i < events; ++i)
+            {
+                VstMidiEvent* ev = (VstMidiEvent*)arena.allocate(sizeof(VstMidiEvent));
+
+                ev->type = kVstMidiType;
+                ev->byteSize = sizeof(*ev);
+
+                lists[i % PORTS].push((VstEvent*)ev);
+            }
+
+            for (VstEventList& list : lists)
+            {
+                if (!list.empty())
+                    dispatch(list.get());
+
+                list.clear();
+            }
+
+            arena.reset();
+        }
+
+        return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / renders;
+    }
+}
+
+int main()
+{
+    printf("%-8s %16s %16s %10s\n", "events", "list ns/render", "arena ns/render", "speedup");
+
+    for (unsigned events : { 16u, 64u, 256u, 1024u, 4096u })
+    {
+        unsigned renders = (1u << 22) / events;
+
+        double list = bench_list(events, renders);
+        double buckets = bench_buckets(events, renders);
+
+        printf("%-8u %16.1f %16.1f %9.2fx\n", events, list, buckets, list / buckets);
+    }
+
+    return 0;
+}
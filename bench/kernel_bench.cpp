@@ -0,0 +1,204 @@
+// Benchmark of the mixdown and sample conversion kernels.
+//
+// Every kernel built into the host is timed at several block sizes for 1, 3,
+// 8 and 16 instances, and its output is compared with the scalar kernel,
+// which must match bit for bit. The double precision kernels are timed the
+// same way.
+
+#include "mixdown.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    const MixdownIsa isas[] = { MixdownIsa::Scalar, MixdownIsa::SSE2, MixdownIsa::AVX2 };
+    const unsigned block_sizes[] = { 64, 256, 1024, 4096, 8192 };
+
+    // Keeps about the same amount of work per measurement at every block size.
+    unsigned repetitions_for(unsigned block_size)
+    {
+        return (unsigned)((1u << 24) / block_size);
+    }
+
+    MixdownKernel mixdown_for(MixdownIsa isa, float)
+    {
+        return mixdown_kernel(isa);
+    }
+
+    MixdownDoubleKernel mixdown_for(MixdownIsa isa, double)
+    {
+        return mixdown_double_kernel(isa);
+    }
+
+    ConvertKernel convert_for(MixdownIsa isa, float)
+    {
+        return convert_kernel(isa);
+    }
+
+    ConvertDoubleKernel convert_for(MixdownIsa isa, double)
+    {
+        return convert_double_kernel(isa);
+    }
+
+    const char* format_name(SampleFormat format)
+    {
+        switch (format)
+        {
+        case SampleFormat::Int16:
+            return "int16";
+
+        case SampleFormat::Int24:
+            return "int24";
+
+        case SampleFormat::Float64:
+            return "f64";
+
+        default:
+            return "f32";
+        }
+    }
+
+    template <typename Sample>
+    bool bench_mixdown(unsigned channels, unsigned instances)
+    {
+        bool identical = true;
+
+        std::mt19937 rng(1234);
+        std::uniform_real_distribution<Sample> distribution(-1.0f, 1.0f);
+
+        for (unsigned block_size : block_sizes)
+        {
+            // laid out like the host does, with padded channel buffers
+            size_t channel_stride = block_size + MIXDOWN_CHANNEL_PADDING;
+
+            std::vector<Sample> in(channel_stride * channels * instances);
+
+            for (Sample& sample : in)
+                sample = distribution(rng);
+
+            std::vector<Sample> reference((size_t)block_size * channels);
+            std::vector<Sample> out((size_t)block_size * channels);
+
+            mixdown_for(MixdownIsa::Scalar, Sample())(reference.data(), in.data(), channel_stride, channel_stride * channels, channels, instances, block_size);
+
+            for (MixdownIsa isa : isas)
+            {
+                auto kernel = mixdown_for(isa, Sample());
+
+                if (kernel == nullptr || (isa != MixdownIsa::Scalar && (int)isa > (int)mixdown_detect_isa()))
+                    continue;
+
+                unsigned repetitions = repetitions_for(block_size);
+
+                auto start = Clock::now();
+
+                for (unsigned i = 0; i < repetitions; ++i)
+                    kernel(out.data(), in.data(), channel_stride, channel_stride * channels, channels, instances, block_size);
+
+                double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+                bool same = memcmp(out.data(), reference.data(), out.size() * sizeof(Sample)) == 0;
+
+                identical = identical && same;
+
+                printf("%-9s %-6s ch=%u inst=%u block=%-5u %8.3f ns/frame %8.2f Mframes/s %s\n", sizeof(Sample) == sizeof(double) ? "mixdown64" : "mixdown", mixdown_isa_name(isa), channels, instances, block_size, ns / ((double)repetitions * block_size), (double)repetitions * block_size / ns * 1e3, same ? "identical" : "MISMATCH");
+            }
+        }
+
+        return identical;
+    }
+
+    template <typename Sample>
+    bool bench_convert(SampleFormat format, bool dither)
+    {
+        bool identical = true;
+
+        std::mt19937 rng(4321);
+        std::uniform_real_distribution<Sample> distribution(-1.1f, 1.1f);
+
+        for (unsigned block_size : block_sizes)
+        {
+            unsigned count = block_size * 2;
+
+            std::vector<Sample> in(count);
+
+            for (Sample& sample : in)
+                sample = distribution(rng);
+
+            std::vector<uint8_t> reference((size_t)count * 8);
+            std::vector<uint8_t> out((size_t)count * 8);
+
+            DitherState reference_dither;
+            reference_dither.enabled = dither;
+
+            convert_for(MixdownIsa::Scalar, Sample())(reference.data(), in.data(), count, format, reference_dither);
+
+            for (MixdownIsa isa : isas)
+            {
+                auto kernel = convert_for(isa, Sample());
+
+                if (kernel == nullptr || (isa != MixdownIsa::Scalar && (int)isa > (int)mixdown_detect_isa()))
+                    continue;
+
+                DitherState state;
+                state.enabled = dither;
+
+                kernel(out.data(), in.data(), count, format, state);
+
+                bool same = memcmp(out.data(), reference.data(), out.size()) == 0;
+
+                identical = identical && same;
+
+                unsigned repetitions = repetitions_for(block_size);
+
+                auto start = Clock::now();
+
+                for (unsigned i = 0; i < repetitions; ++i)
+                    kernel(out.data(), in.data(), count, format, state);
+
+                double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+                printf("%-9s %-6s %-5s%s block=%-5u %8.3f ns/frame %8.2f Mframes/s %s\n", sizeof(Sample) == sizeof(double) ? "convert64" : "convert", mixdown_isa_name(isa), format_name(format), dither ? "+tpdf" : "     ", block_size, ns / ((double)repetitions * block_size), (double)repetitions * block_size / ns * 1e3, same ? "identical" : "MISMATCH");
+            }
+        }
+
+        return identical;
+    }
+}
+
+int main()
+{
+    printf("detected: %s\n", mixdown_isa_name(mixdown_detect_isa()));
+
+    bool identical = true;
+
+    for (unsigned instances : { 1u, 3u, 8u, 16u })
+        identical = bench_mixdown<float>(2, instances) && identical;
+
+    identical = bench_mixdown<float>(1, 3) && identical;
+    identical = bench_mixdown<float>(6, 3) && identical;  // surround
+    identical = bench_mixdown<float>(18, 1) && identical; // stems of three surround instances
+    identical = bench_convert<float>(SampleFormat::Int16, false) && identical;
+    identical = bench_convert<float>(SampleFormat::Int16, true) && identical;
+    identical = bench_convert<float>(SampleFormat::Int24, false) && identical;
+    identical = bench_convert<float>(SampleFormat::Float64, false) && identical;
+
+    for (unsigned instances : { 1u, 3u, 8u, 16u })
+        identical = bench_mixdown<double>(2, instances) && identical;
+
+    identical = bench_mixdown<double>(1, 3) && identical;
+    identical = bench_mixdown<double>(6, 3) && identical;
+    identical = bench_mixdown<double>(18, 1) && identical;
+    identical = bench_convert<double>(SampleFormat::Int16, false) && identical;
+    identical = bench_convert<double>(SampleFormat::Int16, true) && identical;
+    identical = bench_convert<double>(SampleFormat::Int24, false) && identical;
+    identical = bench_convert<double>(SampleFormat::Float32, false) && identical;
+
+    return identical ? 0 : 1;
+}
@@ -0,0 +1,277 @@
+// Mock VST2 synth used by the benchmark suite.
+//
+// It behaves like a well-mannered instrument (synth category, MIDI input,
+// program chunks) while its cost is set through the environment, so that
+// every host instance started by the driver sees the same configuration:
+//
+//   VSTHOST_MOCK_COST      work iterations per sample frame (default 16)
+//   VSTHOST_MOCK_OUTPUTS   number of audio outputs (default 2)
+//   VSTHOST_MOCK_CHUNK     size of the program chunk in bytes (default 65536)
+//   VSTHOST_MOCK_OPEN_MS   time effOpen takes, to model sample loading (default 0)
+//   VSTHOST_MOCK_SAMPLE_KB memory effOpen allocates and touches, to model loaded samples (default 0)
+//   VSTHOST_MOCK_NEED_IDLE request idle calls from the host (default 0)
+//   VSTHOST_MOCK_IDLE_US   time every effIdle call spends working (default 0)
+
+#include "aeffectx.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define MOCK_EXPORT extern "C" __declspec(dllexport)
+#else
+#define MOCK_EXPORT extern "C" __attribute__((visibility("default")))
+#endif
+
+namespace
+{
+    unsigned env_value(const char* name, unsigned fallback)
+    {
+        const char* value = getenv(name);
+
+        if (value == nullptr || *value == 0)
+            return fallback;
+
+        return (unsigned)strtoul(value, nullptr, 0);
+    }
+
+    struct MockSynth
+    {
+        AEffect effect;
+        audioMasterCallback master;
+
+        unsigned cost;
+        unsigned open_ms;
+        unsigned sample_kb;
+        unsigned idle_us;
+        bool need_idle;
+
+        float sample_rate = 44100.0f;
+        float phase[16] = {};
+        float frequency[16] = {};
+        float gain[16] = {};
+
+        uint64_t events_received = 0;
+
+        std::vector<uint8_t> chunk;
+        std::vector<uint8_t> samples;
+    };
+
+    MockSynth* synth_of(AEffect* effect)
+    {
+        return (MockSynth*)effect->object;
+    }
+
+    void handle_midi(MockSynth* synth, const char* data)
+    {
+        unsigned status = (uint8_t)data[0] & 0xF0;
+        unsigned channel = (uint8_t)data[0] & 0x0F;
+        unsigned note = (uint8_t)data[1] & 0x7F;
+        unsigned velocity = (uint8_t)data[2] & 0x7F;
+
+        if (status == 0x90 && velocity)
+        {
+            synth->frequency[channel] = 440.0f * std::pow(2.0f, ((float)note - 69.0f) / 12.0f);
+            synth->gain[channel] = (float)velocity / 127.0f * 0.1f;
+        }
+        else if (status == 0x80 || status == 0x90)
+        {
+            synth->gain[channel] = 0.0f;
+        }
+        else if (status == 0xB0 && (note == 120 || note == 123))
+        {
+            for (float& gain : synth->gain)
+                gain = 0.0f;
+        }
+    }
+
+    VstIntPtr VSTCALLBACK dispatcher(AEffect* effect, VstInt32 opcode, VstInt32, VstIntPtr value, void* ptr, float opt)
+    {
+        MockSynth* synth = synth_of(effect);
+
+        switch (opcode)
+        {
+        case effOpen:
+            if (synth->open_ms)
+                std::this_thread::sleep_for(std::chrono::milliseconds(synth->open_ms));
+
+            synth->samples.assign((size_t)synth->sample_kb * 1024, 0x55);
+
+            if (synth->need_idle)
+                synth->master(effect, DECLARE_VST_DEPRECATED(audioMasterNeedIdle), 0, 0, nullptr, 0);
+            return 0;
+
+        case effClose:
+            delete synth;
+            return 0;
+
+        case effSetSampleRate:
+            synth->sample_rate = opt;
+            return 0;
+
+        case effGetPlugCategory:
+            return kPlugCategSynth;
+
+        case effCanDo:
+            return (ptr && (!strcmp((const char*)ptr, "receiveVstMidiEvent") || !strcmp((const char*)ptr, "receiveVstEvents"))) ? 1 : 0;
+
+        case effGetNumMidiInputChannels:
+            return 16;
+
+        case effSetProcessPrecision:
+            return 1;
+
+        case effGetEffectName:
+            strcpy((char*)ptr, "Mock Synth");
+            return 1;
+
+        case effGetVendorString:
+            strcpy((char*)ptr, "vsthost bench");
+            return 1;
+
+        case effGetProductString:
+            strcpy((char*)ptr, "Mock Synth");
+            return 1;
+
+        case effGetVendorVersion:
+            return 1000;
+
+        case effGetChunk:
+            *(void**)ptr = synth->chunk.data();
+            return (VstIntPtr)synth->chunk.size();
+
+        case effSetChunk:
+            synth->chunk.assign((const uint8_t*)ptr, (const uint8_t*)ptr + value);
+            return 0;
+
+        case DECLARE_VST_DEPRECATED(effIdle):
+        {
+            // busy, like a plugin streaming samples from its idle handler
+            auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(synth->idle_us);
+
+            while (std::chrono::steady_clock::now() < until)
+            {
+            }
+
+            return synth->need_idle ? 1 : 0;
+        }
+
+        case effProcessEvents:
+        {
+            VstEvents* events = (VstEvents*)ptr;
+
+            for (VstInt32 i = 0; i < events->numEvents; ++i)
+            {
+                VstEvent* event = events->events[i];
+
+                if (event->type == kVstMidiType)
+                    handle_midi(synth, ((VstMidiEvent*)event)->midiData);
+            }
+
+            synth->events_received += (uint64_t)events->numEvents;
+            return 1;
+        }
+
+        default:
+            return 0;
+        }
+    }
+
+    template <typename Sample>
+    void render(AEffect* effect, Sample** outputs, VstInt32 frames)
+    {
+        MockSynth* synth = synth_of(effect);
+
+        float step = 6.2831853f / synth->sample_rate;
+
+        for (VstInt32 i = 0; i < frames; ++i)
+        {
+            float sample = 0.0f;
+
+            for (unsigned channel = 0; channel < 16; ++channel)
+            {
+                if (synth->gain[channel] != 0.0f)
+                {
+                    synth->phase[channel] += synth->frequency[channel] * step;
+
+                    if (synth->phase[channel] > 6.2831853f)
+                        synth->phase[channel] -= 6.2831853f;
+
+                    sample += std::sin(synth->phase[channel]) * synth->gain[channel];
+                }
+            }
+
+            // dependent chain the compiler cannot drop, costing roughly one multiply-add per iteration
+            float burn = sample;
+
+            for (unsigned n = 0; n < synth->cost; ++n)
+                burn = burn * 0.999999f + 1e-9f;
+
+            sample += burn * 1e-30f;
+
+            for (VstInt32 channel = 0; channel < effect->numOutputs; ++channel)
+                outputs[channel][i] = (Sample)sample;
+        }
+    }
+
+    void VSTCALLBACK process_replacing(AEffect* effect, float**, float** outputs, VstInt32 frames)
+    {
+        render(effect, outputs, frames);
+    }
+
+    void VSTCALLBACK process_double_replacing(AEffect* effect, double**, double** outputs, VstInt32 frames)
+    {
+        render(effect, outputs, frames);
+    }
+
+    void VSTCALLBACK set_parameter(AEffect*, VstInt32, float)
+    {
+    }
+
+    float VSTCALLBACK get_parameter(AEffect*, VstInt32)
+    {
+        return 0.0f;
+    }
+}
+
+MOCK_EXPORT AEffect* VSTPluginMain(audioMasterCallback master)
+{
+    MockSynth* synth = new MockSynth;
+
+    memset(&synth->effect, 0, sizeof(synth->effect));
+
+    synth->master = master;
+    synth->cost = env_value("VSTHOST_MOCK_COST", 16);
+    synth->open_ms = env_value("VSTHOST_MOCK_OPEN_MS", 0);
+    synth->sample_kb = env_value("VSTHOST_MOCK_SAMPLE_KB", 0);
+    synth->idle_us = env_value("VSTHOST_MOCK_IDLE_US", 0);
+    synth->need_idle = env_value("VSTHOST_MOCK_NEED_IDLE", 0) != 0;
+    synth->chunk.resize(env_value("VSTHOST_MOCK_CHUNK", 65536));
+
+    for (size_t i = 0; i < synth->chunk.size(); ++i)
+        synth->chunk[i] = (uint8_t)i;
+
+    AEffect& effect = synth->effect;
+
+    effect.magic = kEffectMagic;
+    effect.dispatcher = dispatcher;
+    effect.setParameter = set_parameter;
+    effect.getParameter = get_parameter;
+    effect.numPrograms = 1;
+    effect.numParams = 0;
+    effect.numInputs = 0;
+    effect.numOutputs = (VstInt32)env_value("VSTHOST_MOCK_OUTPUTS", 2);
+    effect.flags = effFlagsCanReplacing | effFlagsCanDoubleReplacing | effFlagsIsSynth | effFlagsProgramChunks;
+    effect.object = synth;
+    effect.uniqueID = 0x4D6F636B; // 'Mock'
+    effect.version = 1000;
+    effect.processReplacing = process_replacing;
+    effect.processDoubleReplacing = process_double_replacing;
+
+    return &effect;
+}
@@ -0,0 +1,167 @@
+#include "audio_ring.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#ifdef _WIN32
+#include "stdafx.h"
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static unsigned ring_serial = 0;
+
+AudioRing::~AudioRing()
+{
+    destroy();
+}
+
+bool AudioRing::create(uint32_t capacity)
+{
+    destroy();
+
+    if (capacity == 0)
+        return false;
+
+    size_t data_offset = (sizeof(AudioRingHeader) + 63) & ~size_t(63);
+    size_t size = data_offset + capacity;
+
+    char name_buffer[64];
+
+#ifdef _WIN32
+    snprintf(name_buffer, sizeof(name_buffer), "Local\\vsthost-ring-%lu-%u", (unsigned long)::GetCurrentProcessId(), ring_serial++);
+
+    HANDLE handle = ::CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size, name_buffer);
+
+    if (handle == NULL)
+        return false;
+
+    void* view = ::MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+
+    if (view == nullptr)
+    {
+        ::CloseHandle(handle);
+        return false;
+    }
+
+    mapping = handle;
+#else
+    snprintf(name_buffer, sizeof(name_buffer), "/vsthost-ring-%ld-%u", (long)::getpid(), ring_serial++);
+
+    int fd = ::shm_open(name_buffer, O_CREAT | O_EXCL | O_RDWR, 0600);
+
+    if (fd < 0)
+        return false;
+
+    if (::ftruncate(fd, (off_t)size) != 0)
+    {
+        ::close(fd);
+        ::shm_unlink(name_buffer);
+        return false;
+    }
+
+    void* view = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    ::close(fd);
+
+    if (view == MAP_FAILED)
+    {
+        ::shm_unlink(name_buffer);
+        return false;
+    }
+#endif
+
+    ring_name = name_buffer;
+    mapping_size = size;
+
+    header = new (view) AudioRingHeader;
+    header->magic = AUDIO_RING_MAGIC;
+    header->version = AUDIO_RING_VERSION;
+    header->capacity = capacity;
+    header->data_offset = (uint32_t)data_offset;
+    header->write_position.store(0, std::memory_order_relaxed);
+    header->read_position.store(0, std::memory_order_relaxed);
+
+    data = (uint8_t*)view + data_offset;
+    write_position = 0;
+
+    return true;
+}
+
+void AudioRing::destroy()
+{
+    if (!header)
+        return;
+
+#ifdef _WIN32
+    ::UnmapViewOfFile(header);
+    ::CloseHandle((HANDLE)mapping);
+    mapping = nullptr;
+#else
+    ::munmap(header, mapping_size);
+    ::shm_unlink(ring_name.c_str());
+#endif
+
+    header = nullptr;
+    data = nullptr;
+    write_position = 0;
+    mapping_size = 0;
+    ring_name.clear();
+}
+
+uint32_t AudioRing::writable() const
+{
+    uint64_t read_position = header->read_position.load(std::memory_order_acquire);
+
+    return header->capacity - (uint32_t)(write_position - read_position);
+}
+
+bool AudioRing::wait_writable(uint32_t size, uint32_t timeout_ms) const
+{
+    if (size > header->capacity)
+        return false;
+
+    if (writable() >= size)
+        return true;
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    for (unsigned spins = 0; writable() < size; ++spins)
+    {
+        if (spins < 64)
+            std::this_thread::yield();
+        else if (std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        else
+            return false;
+    }
+
+    return true;
+}
+
+void AudioRing::write(const void* in, uint32_t size)
+{
+    uint32_t capacity = header->capacity;
+    uint32_t offset = (uint32_t)(write_position % capacity);
+    uint32_t first = capacity - offset;
+
+    if (first > size)
+        first = size;
+
+    memcpy(data + offset, in, first);
+
+    if (size > first)
+        memcpy(data, (const uint8_t*)in + first, size - first);
+
+    write_position += size;
+}
+
+void AudioRing::publish()
+{
+    header->write_position.store(write_position, std::memory_order_release);
+}
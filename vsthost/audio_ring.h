@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Shared-memory ring used to hand rendered audio to the client without
+// pushing every block through the pipe.
+//
+// The mapping starts with an AudioRingHeader followed by `capacity` bytes of
+// sample storage. Positions are running byte counts since creation: the host
+// only advances write_position, the client only advances read_position, and
+// the fill level is always their difference.
+enum : uint32_t
+{
+    AUDIO_RING_MAGIC = 0x52495456, // 'VTIR'
+    AUDIO_RING_VERSION = 1
+};
+
+#pragma warning(disable : 4324) // structure was padded due to alignment specifier
+struct AudioRingHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t data_offset;
+
+    alignas(64) std::atomic<uint64_t> write_position;
+    alignas(64) std::atomic<uint64_t> read_position;
+};
+#pragma warning(default : 4324) // structure was padded due to alignment specifier
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring positions must be lock-free to be shared between processes");
+
+class AudioRing
+{
+public:
+    AudioRing() = default;
+    ~AudioRing();
+
+    AudioRing(const AudioRing&) = delete;
+    AudioRing& operator=(const AudioRing&) = delete;
+
+    bool create(uint32_t capacity);
+    void destroy();
+
+    bool is_open() const { return header != nullptr; }
+    const std::string& name() const { return ring_name; }
+    uint32_t capacity() const { return header ? header->capacity : 0; }
+
+    // Bytes the host may write before catching up with the client.
+    uint32_t writable() const;
+
+    // Waits up to timeout_ms for at least `size` writable bytes.
+    bool wait_writable(uint32_t size, uint32_t timeout_ms) const;
+
+    // Copies data behind the write position. The caller must have checked
+    // writable(); nothing becomes visible to the client before publish().
+    void write(const void* data, uint32_t size);
+    void publish();
+
+private:
+    AudioRingHeader* header = nullptr;
+    uint8_t* data = nullptr;
+    uint64_t write_position = 0;
+    size_t mapping_size = 0;
+    std::string ring_name;
+
+#ifdef _WIN32
+    void* mapping = nullptr;
+#endif
+};
@@ -0,0 +1,76 @@
+#include "event_arena.h"
+
+#include <cstring>
+#include <new>
+
+EventArena::EventArena(size_t block_size, size_t limit)
+    : block_size(block_size), limit_bytes(limit)
+{
+}
+
+void* EventArena::allocate(size_t size)
+{
+    size = (size + (ALIGNMENT - 1)) & ~size_t(ALIGNMENT - 1);
+
+    if (size == 0)
+        size = ALIGNMENT;
+
+    // Blocks left over from earlier renders are reused in order; one that is
+    // too small for this request is skipped for the rest of the render.
+    while (current < blocks.size())
+    {
+        Block& block = blocks[current];
+
+        if (block.size - offset >= size)
+        {
+            void* out = block.data.get() + offset;
+
+            memset(out, 0, size);
+
+            offset += size;
+            used_bytes += size;
+
+            if (used_bytes > peak_bytes)
+                peak_bytes = used_bytes;
+
+            return out;
+        }
+
+        ++current;
+        offset = 0;
+    }
+
+    size_t new_size = size > block_size ? size : block_size;
+
+    if (reserved_bytes + new_size > limit_bytes)
+    {
+        ++failed_allocations;
+        return nullptr;
+    }
+
+    Block block;
+    block.data.reset(new (std::nothrow) uint8_t[new_size]);
+    block.size = new_size;
+
+    if (!block.data)
+    {
+        ++failed_allocations;
+        return nullptr;
+    }
+
+    blocks.push_back(std::move(block));
+    reserved_bytes += new_size;
+
+    current = blocks.size() - 1;
+    offset = size;
+    used_bytes += size;
+
+    if (used_bytes > peak_bytes)
+        peak_bytes = used_bytes;
+
+    void* out = blocks[current].data.get();
+
+    memset(out, 0, size);
+
+    return out;
+}
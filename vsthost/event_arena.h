@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Bump allocator for the events queued between two renders.
+//
+// Event nodes and sysex payloads are carved out of a list of blocks that is
+// kept across renders, so a steady stream settles on zero heap allocations.
+// reset() only rewinds the cursor. The total size of the blocks never grows
+// past `limit`; allocations that would exceed it fail and are counted.
+class EventArena
+{
+public:
+    enum : size_t
+    {
+        DEFAULT_BLOCK_SIZE = 64 * 1024,
+        DEFAULT_LIMIT = 64 * 1024 * 1024,
+        ALIGNMENT = 16
+    };
+
+    explicit EventArena(size_t block_size = DEFAULT_BLOCK_SIZE, size_t limit = DEFAULT_LIMIT);
+
+    EventArena(const EventArena&) = delete;
+    EventArena& operator=(const EventArena&) = delete;
+
+    // Returns zero-filled storage, or nullptr when the limit is reached.
+    void* allocate(size_t size);
+
+    void reset()
+    {
+        current = 0;
+        offset = 0;
+        used_bytes = 0;
+    }
+
+    size_t used() const { return used_bytes; }
+    size_t peak() const { return peak_bytes; }
+    size_t reserved() const { return reserved_bytes; }
+    size_t limit() const { return limit_bytes; }
+    uint64_t failures() const { return failed_allocations; }
+
+private:
+    struct Block
+    {
+        std::unique_ptr<uint8_t[]> data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    size_t current = 0;
+    size_t offset = 0;
+
+    size_t block_size;
+    size_t limit_bytes;
+
+    size_t used_bytes = 0;
+    size_t peak_bytes = 0;
+    size_t reserved_bytes = 0;
+    uint64_t failed_allocations = 0;
+};
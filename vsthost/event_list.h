@@ -0,0 +1,90 @@
+#pragma once
+
+#include "aeffectx.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// VstEvents block for one plugin instance that is filled as events arrive
+// and keeps its storage between renders.
+//
+// The storage is laid out exactly like VstEvents: the numEvents/reserved
+// header takes the first two pointer-sized slots and the event pointers
+// follow, so get() hands it to effProcessEvents without copying.
+class VstEventList
+{
+public:
+    enum
+    {
+        HEADER_SLOTS = 2,
+        INITIAL_CAPACITY = 256
+    };
+
+    VstEventList()
+    {
+        storage.resize(HEADER_SLOTS + INITIAL_CAPACITY);
+    }
+
+    void push(VstEvent* ev)
+    {
+        if (HEADER_SLOTS + count == storage.size())
+            storage.resize(storage.size() * 2);
+
+        storage[HEADER_SLOTS + count++] = (VstIntPtr)ev;
+    }
+
+    void clear()
+    {
+        count = 0;
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+    VstEvent* at(size_t index) const
+    {
+        return (VstEvent*)storage[HEADER_SLOTS + index];
+    }
+
+    // Orders the events by deltaFrames, keeping arrival order for equal
+    // timestamps. Clients normally send events in order, so the common case
+    // is a single pass that finds nothing to do.
+    void sort()
+    {
+        auto earlier = [](VstIntPtr a, VstIntPtr b)
+        {
+            return (uint32_t)((VstEvent*)a)->deltaFrames < (uint32_t)((VstEvent*)b)->deltaFrames;
+        };
+
+        auto first = storage.begin() + HEADER_SLOTS;
+        auto last = first + (ptrdiff_t)count;
+
+        if (!std::is_sorted(first, last, earlier))
+            std::stable_sort(first, last, earlier);
+    }
+
+    VstEvents* get()
+    {
+        VstEvents* events = (VstEvents*)storage.data();
+
+        events->numEvents = (VstInt32)count;
+        events->reserved = 0;
+
+        return events;
+    }
+
+private:
+    std::vector<VstIntPtr> storage;
+    size_t count = 0;
+};
+
+static_assert(offsetof(VstEvents, events) == sizeof(VstIntPtr) * VstEventList::HEADER_SLOTS, "VstEvents header must span two pointer slots");
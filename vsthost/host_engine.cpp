@@ -0,0 +1,2583 @@
+#include "host_engine.h"
+
+#include "audio_ring.h"
+#include "event_arena.h"
+#include "event_list.h"
+#include "host_io.h"
+#include "host_stats.h"
+#include "idle_scheduler.h"
+#include "instance_pool.h"
+#include "mixdown.h"
+#include "render_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// #define LOG_EXCHANGE
+
+#ifdef LOG_EXCHANGE
+unsigned exchange_count = 0;
+#endif
+
+std::atomic<bool> need_idle = false;
+bool idle_started = false;
+
+static HostIO* host_io = nullptr;
+
+enum class VSTHostCommand : uint32_t
+{
+    Exit = 0,
+    GetChunk,
+    SetChunk,
+    HasEditor,
+    DisplayEditorModal,
+    SetSampleRate,
+    Reset,
+    SendMIDIEvent,
+    SendSysexEvent,
+    RenderSamples,
+    SendMIDIEventWithTimestamp,
+    SendSysexEventWithTimestamp,
+    MapAudioRing,
+    SendEventBatch,
+    SetParallelRender,
+    SetBlockSize,
+    SetOutputFormat,
+    GetStats,
+    RenderJob,
+    SetPipelineMode,
+    Sync,
+    SetInstancePool,
+    SoftReset,
+    SetPreroll,
+    SetSilenceSkipping,
+    SetInstanceCount,
+    SetLazyInstances,
+    SetPortFolding,
+    SetProcessPrecision,
+    SetOutputLayout,
+};
+
+enum
+{
+    DEFAULT_BLOCK_SIZE = 4096,
+    MIN_BLOCK_SIZE = 16,
+    MAX_BLOCK_SIZE = 65536,
+    DEFAULT_INSTANCE_COUNT = 3,
+    MAX_INSTANCE_COUNT = 64, // ports are 7 bits wide in every event encoding, the stats keep 64 instances
+    PREROLL_SIZE = DEFAULT_BLOCK_SIZE * 200, // frames run through the instances before the first render of idle-driven plugins
+    SILENT_FRAMES_BEFORE_SLEEP = DEFAULT_BLOCK_SIZE * 8 // silence after which SILENCE_SKIP_ANY skips instances that did not declare effFlagsNoSoundInStop
+};
+
+enum : uint32_t
+{
+    PREROLL_BACKGROUND = 1 // SetPreroll flag: start the pre-roll right away, on its own thread
+};
+
+// Peak below which a block counts as silent, about -96 dBFS.
+static const float SILENCE_THRESHOLD = 1.6e-5f;
+
+enum : uint32_t
+{
+    SILENCE_SKIP_OFF = 0,  // SetSilenceSkipping mode: render every instance
+    SILENCE_SKIP_DECLARED, // skip instances that declare effFlagsNoSoundInStop after one silent block
+    SILENCE_SKIP_ANY       // skip the others as well, after SILENT_FRAMES_BEFORE_SLEEP frames of silence
+};
+
+enum : uint32_t
+{
+    OUTPUT_FORMAT_DITHER = 1 // SetOutputFormat flag: TPDF dither for the integer formats
+};
+
+// SetOutputLayout flags. By default the first two outputs of all instances
+// are summed into interleaved frames.
+enum : uint32_t
+{
+    OUTPUT_LAYOUT_ALL_CHANNELS = 1, // every output of the plugin instead of the first two
+    OUTPUT_LAYOUT_STEMS = 2,        // the instances unsummed, one after the other in each frame; implies all channels
+    OUTPUT_LAYOUT_PLANAR = 4        // each block as one run of samples per channel instead of interleaved frames
+};
+
+enum
+{
+    RING_WAIT_TIMEOUT = 10000, // ms to wait for the client to drain the audio ring
+    IDLE_INTERVAL = 20         // ms between the effIdle calls of the idle thread
+};
+
+// Pipelined mode, negotiated with SetPipelineMode: every command word is
+// followed by a sequence number chosen by the client, and replies start with
+// a {code, sequence} frame instead of the bare code. Commands that return
+// nothing (events, SetChunk, SetSampleRate, Reset, SoftReset) are only
+// acknowledged on error or once every `ack interval` of them; any frame
+// acknowledges every command up to its sequence number. RenderJob sends its
+// frame after the audio instead of before it. The client can therefore keep writing
+// the next period's events while it still reads the previous render.
+enum : uint32_t
+{
+    ACK_EVENTS_DROPPED = 1 // pipelined acknowledgement: events were dropped since the last frame
+};
+
+enum : uint32_t
+{
+    GET_STATS_RESET = 1 // GetStats flag: clear histograms and counters once they were sent
+};
+
+enum : uint32_t
+{
+    SOFT_RESET_CYCLE_MAINS = 1 // SoftReset flag: suspend and resume running instances as well
+};
+
+#pragma pack(push, 8)
+#pragma warning(disable : 4820) // x bytes padding added after data member
+struct myVstEvent
+{
+    union
+    {
+        VstMidiEvent midiEvent;
+        VstMidiSysexEvent sysexEvent;
+    } ev;
+};
+#pragma warning(default : 4820) // x bytes padding added after data member
+#pragma pack(pop)
+
+template <typename T>
+static void append_be(std::vector<uint8_t>& out, const T& value)
+{
+    union
+    {
+        T original;
+        uint8_t raw[sizeof(T)];
+    } carriage;
+
+    carriage.original = value;
+
+    for (unsigned i = 0; i < sizeof(T); ++i)
+    {
+        out.push_back(carriage.raw[sizeof(T) - 1 - i]);
+    }
+}
+
+template <typename T>
+static void retrieve_be(T& out, const uint8_t*& in, unsigned& size)
+{
+    if (size < sizeof(T))
+        return;
+
+    size -= sizeof(T);
+
+    union
+    {
+        T original;
+        uint8_t raw[sizeof(T)];
+    } carriage;
+
+    carriage.raw[0] = 0;
+
+    for (unsigned i = 0; i < sizeof(T); ++i)
+    {
+        carriage.raw[sizeof(T) - 1 - i] = *in++;
+    }
+
+    out = carriage.original;
+}
+
+static EventArena event_arena;
+
+static HostStats host_stats;
+
+static uint64_t events_dropped = 0;
+static uint64_t events_dropped_reported = 0;
+
+// Pending events, already bucketed by the instance that plays them. That is
+// the instance of the port they were sent to, unless the port is folded.
+static std::vector<VstEventList> port_events(DEFAULT_INSTANCE_COUNT);
+
+// Slice of port_events handed to an instance for one render block.
+static std::vector<VstEventList> block_events(DEFAULT_INSTANCE_COUNT);
+
+void freeChain()
+{
+    for (VstEventList& events : port_events)
+        events.clear();
+
+    event_arena.reset();
+}
+
+// Events for ports past the last instance go to the last one.
+unsigned clampPort(unsigned port)
+{
+    return std::min(port, (unsigned)port_events.size() - 1);
+}
+
+// Port folding plays several ports on one instance, with the MIDI channels
+// of each port moved to ones the others leave free. Ports past the table
+// have an instance of their own. System exclusive messages of a folded port
+// reach the whole instance, including the channels of the other ports.
+struct PortFold
+{
+    uint8_t instance;
+    uint8_t channels[16];
+};
+
+static std::vector<PortFold> port_folds;
+
+// Instance that plays the events of `port`, which is already clamped.
+unsigned foldedInstance(unsigned port)
+{
+    if (port >= port_folds.size())
+        return port;
+
+    return clampPort(port_folds[port].instance);
+}
+
+myVstEvent* queueEvent(unsigned port)
+{
+    myVstEvent* ev = (myVstEvent*)event_arena.allocate(sizeof(myVstEvent));
+
+    if (ev == nullptr)
+    {
+        host_stats.add(StatsCounter::EventsDropped, 1);
+        events_dropped++;
+        return nullptr;
+    }
+
+    port_events[port].push((VstEvent*)&ev->ev);
+
+    host_stats.add(StatsCounter::EventsQueued, 1);
+
+    return ev;
+}
+
+// Queues a sysex event with room for `size` bytes of message, or returns
+// nullptr when the arena is exhausted and the event has to be dropped.
+myVstEvent* queueSysexEvent(unsigned port, uint32_t size)
+{
+    char* dump = (char*)event_arena.allocate(size);
+
+    if (dump == nullptr)
+    {
+        host_stats.add(StatsCounter::EventsDropped, 1);
+        events_dropped++;
+        return nullptr;
+    }
+
+    myVstEvent* ev = queueEvent(foldedInstance(port));
+
+    if (ev == nullptr)
+        return nullptr;
+
+    ev->ev.sysexEvent.type = kVstSysExType;
+    ev->ev.sysexEvent.byteSize = sizeof(ev->ev.sysexEvent);
+    ev->ev.sysexEvent.dumpBytes = (VstInt32)size;
+    ev->ev.sysexEvent.sysexDump = dump;
+
+    return ev;
+}
+
+// Queues a short MIDI message sent to `port`, `bytes` holding the status
+// byte in its lowest byte, with the channel remapped when the port is folded.
+myVstEvent* queueMidiEvent(unsigned port, uint32_t bytes, uint32_t timestamp)
+{
+    myVstEvent* ev = queueEvent(foldedInstance(port));
+
+    if (ev == nullptr)
+        return nullptr;
+
+    ev->ev.midiEvent.type = kVstMidiType;
+    ev->ev.midiEvent.byteSize = sizeof(ev->ev.midiEvent);
+    ev->ev.midiEvent.deltaFrames = (VstInt32)timestamp;
+
+    memcpy(&ev->ev.midiEvent.midiData, &bytes, 3);
+
+    uint8_t status = (uint8_t)bytes;
+
+    if (port < port_folds.size() && status >= 0x80 && status < 0xF0)
+        ev->ev.midiEvent.midiData[0] = (char)((status & 0xF0) | port_folds[port].channels[status & 15]);
+
+    return ev;
+}
+
+// Queues the controllers that silence every channel of `port`, delivered at
+// the start of the next render. Reset All Controllers goes before All Notes
+// Off, so notes held by the sustain pedal are released too.
+void queuePanic(unsigned port)
+{
+    static const uint8_t panic_controllers[] = { 120, 121, 123 }; // All Sound Off, Reset All Controllers, All Notes Off
+
+    for (unsigned channel = 0; channel < 16; ++channel)
+    {
+        for (uint8_t controller : panic_controllers)
+        {
+            myVstEvent* ev = queueEvent(port);
+
+            if (ev == nullptr)
+                return;
+
+            ev->ev.midiEvent.type = kVstMidiType;
+            ev->ev.midiEvent.byteSize = sizeof(ev->ev.midiEvent);
+            ev->ev.midiEvent.midiData[0] = (char)(0xB0 | channel);
+            ev->ev.midiEvent.midiData[1] = (char)controller;
+            ev->ev.midiEvent.midiData[2] = 0;
+        }
+    }
+}
+
+// Moves the pending events of `instance` into `held`, out of the arena the
+// next render clears, for an instance that cannot play them yet.
+void holdEvents(unsigned instance, std::vector<uint8_t>& held)
+{
+    VstEventList& events = port_events[instance];
+
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        const myVstEvent* ev = (const myVstEvent*)events.at(i);
+
+        uint32_t dump_bytes = ev->ev.sysexEvent.type == kVstSysExType ? (uint32_t)ev->ev.sysexEvent.dumpBytes : 0;
+
+        size_t offset = held.size();
+
+        held.resize(offset + sizeof(myVstEvent) + dump_bytes);
+
+        memcpy(&held[offset], ev, sizeof(myVstEvent));
+
+        if (dump_bytes)
+            memcpy(&held[offset + sizeof(myVstEvent)], ev->ev.sysexEvent.sysexDump, dump_bytes);
+    }
+
+    events.clear();
+}
+
+// Queues the events holdEvents kept for `instance` again, at the start of
+// the next block and ahead of the ones that came since. The ones the arena
+// has no room for are dropped and counted like any other.
+void releaseEvents(unsigned instance, std::vector<uint8_t>& held)
+{
+    VstEventList& events = port_events[instance];
+
+    std::vector<VstEvent*> later(events.size());
+
+    for (size_t i = 0; i < later.size(); ++i)
+        later[i] = events.at(i);
+
+    events.clear();
+
+    for (size_t offset = 0; offset < held.size();)
+    {
+        myVstEvent copy;
+        memcpy(&copy, &held[offset], sizeof(copy));
+        offset += sizeof(copy);
+
+        uint32_t dump_bytes = copy.ev.sysexEvent.type == kVstSysExType ? (uint32_t)copy.ev.sysexEvent.dumpBytes : 0;
+
+        char* dump = nullptr;
+
+        if (dump_bytes)
+        {
+            dump = (char*)event_arena.allocate(dump_bytes);
+
+            if (dump == nullptr)
+            {
+                host_stats.add(StatsCounter::EventsDropped, 1);
+                events_dropped++;
+                offset += dump_bytes;
+                continue;
+            }
+
+            memcpy(dump, &held[offset], dump_bytes);
+            offset += dump_bytes;
+        }
+
+        myVstEvent* ev = queueEvent(instance);
+
+        if (ev == nullptr)
+            continue;
+
+        *ev = copy;
+        ev->ev.midiEvent.deltaFrames = 0;
+
+        if (dump)
+            ev->ev.sysexEvent.sysexDump = dump;
+    }
+
+    for (VstEvent* ev : later)
+        events.push(ev);
+
+    held.clear();
+}
+
+// SendEventBatch and RenderJob pack events as a sequence of records, each
+// made of a tag word, a timestamp word and, for sysex, the message padded to
+// 4 bytes:
+//
+//   tag bit 31     set for sysex
+//   tag bits 24-30 port
+//   tag bits 0-23  MIDI bytes, or the sysex length
+enum : uint32_t
+{
+    BATCH_SYSEX_FLAG = 0x80000000
+};
+
+bool queueEventBatch(const uint8_t* in, uint32_t size)
+{
+    while (size)
+    {
+        if (size < sizeof(uint32_t) * 2)
+            return false;
+
+        uint32_t tag;
+        uint32_t timestamp;
+
+        memcpy(&tag, in, sizeof(tag));
+        memcpy(&timestamp, in + sizeof(tag), sizeof(timestamp));
+
+        in += sizeof(uint32_t) * 2;
+        size -= sizeof(uint32_t) * 2;
+
+        unsigned port = clampPort((tag & 0x7F000000) >> 24);
+
+        if (tag & BATCH_SYSEX_FLAG)
+        {
+            uint32_t length = tag & 0xFFFFFF;
+            uint32_t padded_length = (length + 3) & ~3u;
+
+            if (padded_length > size)
+                return false;
+
+            myVstEvent* ev = queueSysexEvent(port, length);
+
+            if (ev != nullptr)
+            {
+                ev->ev.sysexEvent.deltaFrames = (VstInt32)timestamp;
+
+                memcpy(ev->ev.sysexEvent.sysexDump, in, length);
+            }
+
+            in += padded_length;
+            size -= padded_length;
+        }
+        else
+            queueMidiEvent(port, tag, timestamp);
+    }
+
+    return true;
+}
+
+void put_bytes(const void* out, uint32_t size)
+{
+    host_io->write(out, size);
+
+#ifdef LOG_EXCHANGE
+    char logfile[64];
+    snprintf(logfile, sizeof(logfile), "log/bytes_%08u.out", exchange_count++);
+    FILE* f = fopen(logfile, "wb");
+    fwrite(out, 1, size, f);
+    fclose(f);
+#endif
+}
+
+void put_code(uint32_t code)
+{
+    put_bytes(&code, sizeof(code));
+}
+
+static uint32_t ack_interval = 0; // zero outside pipelined mode
+static uint32_t ack_pending = 0;
+static uint32_t command_sequence = 0;
+
+// Starts the reply of a command that returns data, or reports an error.
+void put_reply(uint32_t code)
+{
+    put_code(code);
+
+    if (ack_interval)
+    {
+        put_code(command_sequence);
+        ack_pending = 0;
+        events_dropped_reported = events_dropped;
+    }
+}
+
+// Acknowledges a command that returns nothing.
+void put_ack()
+{
+    if (ack_interval == 0)
+    {
+        put_code(0);
+        return;
+    }
+
+    if (events_dropped != events_dropped_reported)
+        put_reply(ACK_EVENTS_DROPPED);
+    else if (++ack_pending >= ack_interval)
+        put_reply(0);
+}
+
+void get_bytes(void* in, uint32_t size)
+{
+    if (!host_io->read(in, size))
+    {
+        memset(in, 0, size);
+
+#ifdef LOG_EXCHANGE
+        char logfile[64];
+        snprintf(logfile, sizeof(logfile), "log/bytes_%08u.err", exchange_count++);
+        FILE* f = fopen(logfile, "wb");
+        fprintf(f, "Wanted %u bytes", size);
+        fclose(f);
+#endif
+    }
+    else
+    {
+#ifdef LOG_EXCHANGE
+        char logfile[64];
+        snprintf(logfile, sizeof(logfile), "log/bytes_%08u.in", exchange_count++);
+        FILE* f = fopen(logfile, "wb");
+        fwrite(in, 1, size, f);
+        fclose(f);
+#endif
+    }
+}
+
+uint32_t get_code()
+{
+    uint32_t code;
+
+    get_bytes(&code, sizeof(code));
+
+    return code;
+}
+
+void skip_bytes(uint32_t size)
+{
+    uint8_t discard[1024];
+
+    while (size)
+    {
+        uint32_t size_to_do = std::min(size, (uint32_t)sizeof(discard));
+
+        get_bytes(discard, size_to_do);
+
+        size -= size_to_do;
+    }
+}
+
+// Destination of the rendered audio of one RenderSamples reply.
+class AudioOutput
+{
+public:
+    virtual ~AudioOutput() = default;
+
+    virtual bool write(const void* data, uint32_t frames, uint32_t frame_bytes) = 0;
+
+    // Writes frames that can not be split, like a planar block.
+    virtual bool write_block(const void* data, uint32_t frames, uint32_t frame_bytes) = 0;
+
+    virtual bool finish() = 0;
+};
+
+// Streams the samples through the pipe right behind the acknowledgement.
+class PipeAudioOutput final : public AudioOutput
+{
+public:
+    bool write(const void* data, uint32_t frames, uint32_t frame_bytes) override
+    {
+        put_bytes(data, frames * frame_bytes);
+        return true;
+    }
+
+    bool write_block(const void* data, uint32_t frames, uint32_t frame_bytes) override
+    {
+        return write(data, frames, frame_bytes);
+    }
+
+    bool finish() override
+    {
+        return true;
+    }
+};
+
+// Copies the samples into the shared audio ring and only sends the number of
+// frames that became readable. A notification goes out whenever the ring is
+// full, so the client can drain it while the host waits, and once at the end
+// of the reply. The counts of one reply add up to the requested sample count.
+class RingAudioOutput final : public AudioOutput
+{
+public:
+    explicit RingAudioOutput(AudioRing& ring) : ring(ring)
+    {
+    }
+
+    bool write(const void* data, uint32_t frames, uint32_t frame_bytes) override
+    {
+        const uint8_t* in = (const uint8_t*)data;
+
+        while (frames)
+        {
+            uint32_t frames_to_do = std::min(frames, ring.writable() / frame_bytes);
+
+            if (frames_to_do == 0)
+            {
+                notify();
+
+                // The client only drains the ring after hearing about it.
+                host_io->flush();
+
+                if (!ring.wait_writable(frame_bytes, RING_WAIT_TIMEOUT))
+                    return false;
+
+                continue;
+            }
+
+            ring.write(in, frames_to_do * frame_bytes);
+
+            in += frames_to_do * frame_bytes;
+            frames -= frames_to_do;
+            pending_frames += frames_to_do;
+        }
+
+        return true;
+    }
+
+    // The ring has to be able to hold the whole block.
+    bool write_block(const void* data, uint32_t frames, uint32_t frame_bytes) override
+    {
+        uint32_t size = frames * frame_bytes;
+
+        if (size > ring.capacity())
+            return false;
+
+        if (ring.writable() < size)
+        {
+            notify();
+
+            host_io->flush();
+
+            if (!ring.wait_writable(size, RING_WAIT_TIMEOUT))
+                return false;
+        }
+
+        ring.write(data, size);
+
+        pending_frames += frames;
+
+        return true;
+    }
+
+    bool finish() override
+    {
+        notify();
+        return true;
+    }
+
+private:
+    void notify()
+    {
+        if (pending_frames)
+        {
+            ring.publish();
+            put_code(pending_frames);
+            pending_frames = 0;
+        }
+    }
+
+    AudioRing& ring;
+    uint32_t pending_frames = 0;
+};
+
+void getChunk(AEffect* effect, std::vector<uint8_t>& out)
+{
+    out.resize(0);
+
+    uint32_t unique_id = (uint32_t)effect->uniqueID;
+
+    append_be(out, unique_id);
+
+    bool type_chunked = !!(effect->flags & effFlagsProgramChunks);
+
+    append_be(out, type_chunked);
+
+    if (!type_chunked)
+    {
+        uint32_t num_params = (uint32_t)effect->numParams;
+
+        append_be(out, num_params);
+
+        for (uint32_t i = 0; i < num_params; ++i)
+        {
+            float parameter = effect->getParameter(effect, (VstInt32)i);
+
+            append_be(out, parameter);
+        }
+    }
+    else
+    {
+        void* chunk;
+
+        uint32_t size = (uint32_t)effect->dispatcher(effect, effGetChunk, 0, 0, &chunk, 0);
+
+        append_be(out, size);
+
+        size_t chunk_size = out.size();
+
+        out.resize(chunk_size + size);
+
+        memcpy(&out[chunk_size], chunk, size);
+    }
+}
+
+void setChunk(AEffect* pEffect, std::vector<uint8_t> const& in)
+{
+    uint32_t size = (uint32_t)in.size();
+
+    if (pEffect == nullptr || size == 0)
+        return;
+
+    const uint8_t* inc = in.data();
+
+    uint32_t effect_id = 0;
+
+    retrieve_be(effect_id, inc, size);
+
+    if (effect_id != (uint32_t)pEffect->uniqueID)
+        return;
+
+    bool type_chunked = false;
+
+    retrieve_be(type_chunked, inc, size);
+
+    if (type_chunked != !!(pEffect->flags & effFlagsProgramChunks))
+        return;
+
+    if (!type_chunked)
+    {
+        uint32_t num_params = 0;
+
+        retrieve_be(num_params, inc, size);
+
+        if (num_params != (uint32_t)pEffect->numParams)
+            return;
+
+        for (uint32_t i = 0; i < num_params; ++i)
+        {
+            float parameter = 0.0f;
+
+            retrieve_be(parameter, inc, size);
+
+            pEffect->setParameter(pEffect, (VstInt32)i, parameter);
+        }
+    }
+    else
+    {
+        uint32_t chunk_size = 0;
+
+        retrieve_be(chunk_size, inc, size);
+
+        if (chunk_size > size)
+            return;
+
+        pEffect->dispatcher(pEffect, effSetChunk, 0, (VstIntPtr)chunk_size, (void*)inc, 0);
+    }
+}
+
+// Instances can only be rendered concurrently if the plugin really handed out
+// separate objects; some plugins return the same AEffect on every call.
+bool distinctInstances(AEffect* const* effects, unsigned count)
+{
+    for (unsigned i = 0; i < count; ++i)
+    {
+        if (effects[i] == nullptr)
+            continue;
+
+        for (unsigned j = i + 1; j < count; ++j)
+        {
+            if (effects[j] == nullptr)
+                continue;
+
+            if (effects[i] == effects[j] || (effects[i]->object && effects[i]->object == effects[j]->object))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+// Whether an instance is left out of the render. It goes to sleep once its
+// output stayed silent for long enough without events, and wakes up with the
+// next event for its port. The output buffers of a sleeping instance are
+// zeroed once, so the mixdown may still read them.
+struct InstanceActivity
+{
+    uint32_t silent_frames = 0;
+    bool sleeping = false;
+
+    void wake()
+    {
+        silent_frames = 0;
+        sleeping = false;
+    }
+};
+
+// The render functions below take float lists for processReplacing or
+// double lists for processDoubleReplacing, in the precision negotiated with
+// SetProcessPrecision.
+inline void processBlock(AEffect* effect, float** inputs, float** outputs, VstInt32 sample_count)
+{
+    effect->processReplacing(effect, inputs, outputs, sample_count);
+}
+
+inline void processBlock(AEffect* effect, double** inputs, double** outputs, VstInt32 sample_count)
+{
+    effect->processDoubleReplacing(effect, inputs, outputs, sample_count);
+}
+
+// Runs one block through instances `first` to `first + count - 1`, each
+// writing its own slice of the output lists, except the ones that are not
+// open or that `activity` has asleep. With a pool the instances run
+// concurrently and this returns once all of them are done. Each instance
+// records into its own histogram, so the workers never share one; the
+// pre-roll leaves them out with `record_stats` false.
+template <typename Sample>
+void renderInstances(AEffect* const* effects, unsigned first, unsigned count, Sample** inputs, Sample** outputs, uint32_t num_outputs, VstInt32 sample_count, RenderPool* pool, const InstanceActivity* activity, bool record_stats)
+{
+    auto render = [&](unsigned n)
+    {
+        unsigned i = first + n;
+
+        if (effects[i] == nullptr)
+            return;
+
+        if (activity && activity[i].sleeping)
+        {
+            host_stats.frames(i).skipped += (uint64_t)sample_count;
+            return;
+        }
+
+        StatsClock::time_point start = StatsClock::now();
+
+        processBlock(effects[i], inputs, outputs + num_outputs * i, sample_count);
+
+        if (!record_stats)
+            return;
+
+        host_stats.instance(i).record_since(start);
+        host_stats.frames(i).rendered += (uint64_t)sample_count;
+    };
+
+    if (pool)
+        pool->run(count, render);
+    else
+    {
+        for (unsigned n = 0; n < count; ++n)
+            render(n);
+    }
+}
+
+// How much audio is run through idle-driven instances before their first
+// render. A non-zero `silent_blocks` ends it early, once that many blocks in
+// a row came out silent; `frames` stays the upper bound.
+struct PrerollSettings
+{
+    uint32_t frames = PREROLL_SIZE;
+    uint32_t silent_blocks = 0;
+};
+
+template <typename Sample>
+bool blockSilent(Sample* const* outputs, uint32_t channels, uint32_t count)
+{
+    for (uint32_t channel = 0; channel < channels; ++channel)
+    {
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            if (std::fabs(outputs[channel][i]) > SILENCE_THRESHOLD)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+// Checks the block every awake instance just rendered and puts the ones that
+// went quiet long enough to sleep, unless `mode` is SILENCE_SKIP_OFF. The
+// silence of sleeping instances keeps counting, for the idle teardown.
+template <typename Sample>
+void updateActivity(InstanceActivity* activity, AEffect* const* effects, unsigned count, Sample** outputs, uint32_t num_outputs, uint32_t block_size, uint32_t sample_count, uint32_t mode)
+{
+    for (unsigned i = 0; i < count; ++i)
+    {
+        if (effects[i] == nullptr)
+            continue;
+
+        uint32_t silent_frames = activity[i].silent_frames + sample_count;
+
+        if (silent_frames < sample_count)
+            silent_frames = UINT32_MAX;
+
+        if (activity[i].sleeping)
+        {
+            activity[i].silent_frames = silent_frames;
+            continue;
+        }
+
+        Sample** instance_outputs = outputs + num_outputs * i;
+
+        if (!blockSilent(instance_outputs, num_outputs, sample_count))
+        {
+            activity[i].silent_frames = 0;
+            continue;
+        }
+
+        activity[i].silent_frames = silent_frames;
+
+        uint32_t sleep_after;
+
+        if (mode == SILENCE_SKIP_OFF)
+            continue;
+
+        if (effects[i]->flags & effFlagsNoSoundInStop)
+            sleep_after = 1;
+        else if (mode == SILENCE_SKIP_ANY)
+            sleep_after = SILENT_FRAMES_BEFORE_SLEEP;
+        else
+            continue;
+
+        if (activity[i].silent_frames >= sleep_after)
+        {
+            activity[i].sleeping = true;
+
+            for (uint32_t channel = 0; channel < num_outputs; ++channel)
+                memset(instance_outputs[channel], 0, block_size * sizeof(Sample));
+        }
+    }
+}
+
+inline void mixdownSamples(float* out, const float* in, size_t channel_stride, size_t instance_stride, unsigned channels, unsigned instances, unsigned count)
+{
+    mixdown(out, in, channel_stride, instance_stride, channels, instances, count);
+}
+
+inline void mixdownSamples(double* out, const double* in, size_t channel_stride, size_t instance_stride, unsigned channels, unsigned instances, unsigned count)
+{
+    mixdown_double(out, in, channel_stride, instance_stride, channels, instances, count);
+}
+
+// Gathers the block the instances rendered from `rendered` into `out`, in
+// the layout set by the OUTPUT_LAYOUT_* flags. Only the instances from
+// `first_awake` to `last_awake - 1` are summed, the others hold silence.
+template <typename Sample>
+void assembleBlock(Sample* out, const Sample* rendered, size_t channel_stride, uint32_t num_outputs, uint32_t channels, unsigned instance_count, unsigned first_awake, unsigned last_awake, uint32_t layout, uint32_t count)
+{
+    size_t instance_stride = channel_stride * num_outputs;
+    bool planar = (layout & OUTPUT_LAYOUT_PLANAR) != 0;
+
+    if (layout & OUTPUT_LAYOUT_STEMS)
+    {
+        // Stems carry every output, so the channels of all instances follow
+        // each other like those of a single wide instance.
+        unsigned stem_channels = num_outputs * instance_count;
+
+        if (planar)
+        {
+            for (unsigned channel = 0; channel < stem_channels; ++channel)
+                memcpy(out + (size_t)count * channel, rendered + channel_stride * channel, count * sizeof(Sample));
+        }
+        else
+            mixdownSamples(out, rendered, channel_stride, instance_stride, stem_channels, 1, count);
+
+        return;
+    }
+
+    if (first_awake >= last_awake)
+    {
+        memset(out, 0, (size_t)count * channels * sizeof(Sample));
+        return;
+    }
+
+    const Sample* in = rendered + instance_stride * first_awake;
+    unsigned instances = last_awake - first_awake;
+
+    if (planar)
+    {
+        for (uint32_t channel = 0; channel < channels; ++channel)
+            mixdownSamples(out + (size_t)count * channel, in + channel_stride * channel, channel_stride, instance_stride, 1, instances, count);
+    }
+    else
+        mixdownSamples(out, in, channel_stride, instance_stride, channels, instances, count);
+}
+
+// Runs the pre-roll through the open instances from `first` to
+// `first + count - 1`, with the effIdle calls the plugins load their samples
+// in between the blocks, and throws the output away. With `block_mutex`,
+// every block holds it, so the pre-roll only runs between the commands.
+// Returns the number of frames run.
+template <typename Sample>
+uint32_t runPreroll(AEffect* const* effects, unsigned first, unsigned count, Sample** inputs, Sample** outputs, uint32_t num_outputs, uint32_t block_size, const PrerollSettings& settings, RenderPool* pool, std::mutex* block_mutex)
+{
+    uint32_t done = 0;
+    uint32_t silent_blocks = 0;
+
+    while (done < settings.frames)
+    {
+        // Gives a command waiting for the instances its turn first.
+        if (block_mutex && done)
+            std::this_thread::yield();
+
+        std::unique_lock<std::mutex> lock;
+
+        if (block_mutex)
+            lock = std::unique_lock<std::mutex>(*block_mutex);
+
+        uint32_t count_to_do = std::min(settings.frames - done, block_size);
+
+        renderInstances(effects, first, count, inputs, outputs, num_outputs, (VstInt32)count_to_do, pool, nullptr, false);
+
+        for (unsigned i = first; i < first + count; ++i)
+        {
+            if (effects[i])
+                effects[i]->dispatcher(effects[i], DECLARE_VST_DEPRECATED(effIdle), 0, 0, 0, 0);
+        }
+
+        done += count_to_do;
+
+        // Closed instances left their buffers zeroed, they do not hold it up.
+        if (settings.silent_blocks)
+        {
+            if (!blockSilent(outputs + num_outputs * first, num_outputs * count, count_to_do))
+                silent_blocks = 0;
+            else if (++silent_blocks >= settings.silent_blocks)
+                break;
+        }
+    }
+
+    return done;
+}
+
+// An instance opened while the others are running. It runs its pre-roll on a
+// thread of its own, into buffers of its own, and stays out of the render
+// until that is done, so the stream does not stall on it. Unless the
+// instances may render in parallel, the thread takes `block_mutex` for every
+// block, so the plugin is never called from two threads at once.
+struct WarmingInstance
+{
+    unsigned index = 0;
+    AEffect* effect = nullptr;
+    std::thread thread;
+    std::atomic<bool> done = false;
+    uint32_t frames = 0;
+    StatsClock::time_point start;
+    StatsClock::time_point end;
+    std::vector<uint8_t> held_events; // for its port, meanwhile
+};
+
+template <typename Sample>
+void runWarmup(WarmingInstance& warming, uint32_t num_inputs, uint32_t num_outputs, uint32_t block_size, const PrerollSettings& settings, std::mutex* block_mutex)
+{
+    unsigned index = warming.index;
+
+    std::vector<AEffect*> effects(index + 1, nullptr);
+    effects[index] = warming.effect;
+
+    // The null input, then the outputs of the instance.
+    std::vector<Sample> samples((size_t)block_size * (num_outputs + 1));
+    std::vector<Sample*> inputs(std::max(num_inputs, 1u), samples.data());
+    std::vector<Sample*> outputs((size_t)num_outputs * (index + 1), nullptr);
+
+    for (uint32_t channel = 0; channel < num_outputs; ++channel)
+        outputs[(size_t)num_outputs * index + channel] = samples.data() + (size_t)block_size * (channel + 1);
+
+    warming.frames = runPreroll(effects.data(), index, 1, inputs.data(), outputs.data(), num_outputs, block_size, settings, nullptr, block_mutex);
+    warming.end = StatsClock::now();
+    warming.done = true;
+}
+
+// Everything but the commands that only queue events or talk to the client.
+// Those can go on while the background pre-roll or the idle thread own the
+// instances.
+bool usesInstances(VSTHostCommand command)
+{
+    switch (command)
+    {
+    case VSTHostCommand::SendMIDIEvent:
+    case VSTHostCommand::SendSysexEvent:
+    case VSTHostCommand::SendMIDIEventWithTimestamp:
+    case VSTHostCommand::SendSysexEventWithTimestamp:
+    case VSTHostCommand::SendEventBatch:
+    case VSTHostCommand::SetPipelineMode:
+    case VSTHostCommand::Sync:
+        return false;
+
+    default:
+        return true;
+    }
+}
+
+// Hands `effect` the events of `port` that fall into the block starting
+// `block_start` frames into the render, with deltaFrames rebased to the
+// block. `next` is the first event not dispatched yet, the list must be
+// sorted. The last block also takes every later event, clamped to its last
+// frame. Returns the dispatched block, or nullptr if it was empty.
+VstEvents* dispatchBlockEvents(AEffect* effect, unsigned port, size_t& next, uint32_t block_start, uint32_t block_size, bool last_block)
+{
+    VstEventList& pending = port_events[port];
+    VstEventList& block = block_events[port];
+
+    block.clear();
+
+    uint32_t block_end = block_start + block_size;
+
+    while (next < pending.size())
+    {
+        VstEvent* ev = pending.at(next);
+
+        uint32_t timestamp = (uint32_t)ev->deltaFrames;
+
+        if (timestamp >= block_end && !last_block)
+            break;
+
+        if (timestamp < block_start)
+            timestamp = block_start;
+        else if (timestamp >= block_end)
+            timestamp = block_size ? block_end - 1 : block_start;
+
+        ev->deltaFrames = (VstInt32)(timestamp - block_start);
+
+        block.push(ev);
+        next++;
+    }
+
+    if (block.empty())
+        return nullptr;
+
+    VstEvents* events = block.get();
+
+    effect->dispatcher(effect, effProcessEvents, 0, 0, events, 0);
+
+    return events;
+}
+
+unsigned runHostEngine(HostIO& io, const HostPlugin& plugin)
+{
+    host_io = &io;
+
+    unsigned code = 0;
+
+    // Never resized, the instances keep pointers into it.
+    audioMasterData effectData[MAX_INSTANCE_COUNT];
+
+    for (unsigned i = 0; i < MAX_INSTANCE_COUNT; ++i)
+        effectData[i].effect_number = (VstIntPtr)i;
+
+    std::vector<uint8_t> State;
+
+    uint32_t SampleRate = 44100;
+    uint32_t BlockSize = DEFAULT_BLOCK_SIZE;
+
+    std::vector<uint8_t> chunk;
+    std::vector<float> sample_buffer;
+    std::vector<uint8_t> event_batch;
+    std::vector<uint8_t> stats_reply;
+
+    SampleFormat OutputFormat = SampleFormat::Float32;
+    uint32_t output_layout = 0;
+    DitherState Dither;
+    std::vector<uint8_t> converted_buffer;
+
+    AudioRing audio_ring;
+
+    std::unique_ptr<RenderPool> render_pool;
+    std::unique_ptr<InstancePool> instance_pool;
+    bool parallel_render = false;
+
+    uint32_t silence_skipping = SILENCE_SKIP_OFF;
+
+    bool lazy_instances = false; // opt-in, clients that never send events for a port still get its instance
+    uint32_t idle_close_ms = 0; // zero keeps lazily opened instances open
+    std::vector<InstanceActivity> activity(DEFAULT_INSTANCE_COUNT);
+
+    // Only the lists of the negotiated precision are laid out.
+    bool double_precision = false;
+    float** float_list_in = nullptr;
+    float** float_list_out = nullptr;
+    float* float_out = nullptr;
+    double** double_list_in = nullptr;
+    double** double_list_out = nullptr;
+    double* double_out = nullptr;
+    std::vector<double> double_sample_buffer;
+    size_t channel_stride = 0;
+    uint32_t max_num_outputs;
+    std::vector<AEffect*> Effect(DEFAULT_INSTANCE_COUNT, nullptr);
+    std::vector<size_t> next_event;
+    std::vector<VstEvents*> block_dispatched;
+    main_func Main = plugin.entry;
+
+    PrerollSettings preroll;
+    bool preroll_done = false;
+    std::thread preroll_thread;
+    uint32_t preroll_frames = 0;
+    StatsClock::time_point preroll_start;
+    StatsClock::time_point preroll_end;
+    std::vector<std::unique_ptr<WarmingInstance>> warming;
+
+    // Held by whoever calls into the instances: the command loop, the
+    // background pre-roll or the idle thread.
+    std::mutex instance_mutex;
+    std::unique_ptr<IdleScheduler> idle_scheduler;
+
+    // Opens the instance of `slot`, from the warm pool when it has one ready.
+    auto openInstance = [&](unsigned slot) -> AEffect*
+    {
+        AEffect* effect = instance_pool ? instance_pool->take(slot) : nullptr;
+
+        if (effect)
+        {
+            host_stats.add(StatsCounter::InstancesFromPool, 1);
+            return effect;
+        }
+
+        effect = Main(plugin.master);
+
+        if (effect == nullptr)
+            return nullptr;
+
+        effect->user = &effectData[slot];
+        effect->dispatcher(effect, effOpen, 0, 0, 0, 0);
+
+        setChunk(effect, chunk);
+
+        host_stats.add(StatsCounter::InstancesCreated, 1);
+
+        return effect;
+    };
+
+    // Calls `body` with the input and output lists of the negotiated precision.
+    auto withSampleLists = [&](auto&& body)
+    {
+        if (double_precision)
+            body(double_list_in, double_list_out);
+        else
+            body(float_list_in, float_list_out);
+    };
+
+    // Channels of a reply frame, which has every instance in it with stems.
+    auto replyChannels = [&]() -> uint32_t
+    {
+        return max_num_outputs * ((output_layout & OUTPUT_LAYOUT_STEMS) ? (uint32_t)Effect.size() : 1u);
+    };
+
+    // Whether a mapped audio ring still takes the replies of a layout: a
+    // planar block goes in whole, interleaved frames one at a time. Changes
+    // it would not take are refused while it is mapped.
+    auto ringFits = [&](uint32_t block_size, uint32_t channels, SampleFormat format, uint32_t layout) -> bool
+    {
+        uint64_t frames = (layout & OUTPUT_LAYOUT_PLANAR) ? block_size : 1;
+
+        return !audio_ring.is_open() || frames * channels * sample_format_bytes(format) <= audio_ring.capacity();
+    };
+
+    auto sizeReplyBuffers = [&]
+    {
+        size_t NewSize = (size_t)BlockSize * replyChannels();
+
+        if (double_precision)
+            double_sample_buffer.resize(NewSize);
+        else
+            sample_buffer.resize(NewSize);
+
+        converted_buffer.resize(NewSize * sizeof(double));
+    };
+
+    auto startInstance = [&](AEffect* effect)
+    {
+        if (effect->flags & effFlagsCanDoubleReplacing)
+            effect->dispatcher(effect, effSetProcessPrecision, 0, double_precision ? kVstProcessPrecision64 : kVstProcessPrecision32, 0, 0);
+
+        effect->dispatcher(effect, effSetSampleRate, 0, 0, 0, float(SampleRate));
+        effect->dispatcher(effect, effSetBlockSize, 0, (VstIntPtr)BlockSize, 0, 0);
+        effect->dispatcher(effect, effMainsChanged, 0, 1, 0, 0);
+        effect->dispatcher(effect, effStartProcess, 0, 0, 0, 0);
+    };
+
+    // Whether instance `index` is still warming up, see startInstances.
+    auto instanceWarming = [&](unsigned index) -> bool
+    {
+        for (const auto& w : warming)
+        {
+            if (w->index == index)
+                return true;
+        }
+
+        return false;
+    };
+
+    // Waits until every instance is done warming up, for the commands that
+    // touch every instance. The threads may need the instances on the way,
+    // so this is called before taking them.
+    auto waitWarming = [&]
+    {
+        for (const auto& w : warming)
+        {
+            if (w->thread.joinable())
+                w->thread.join();
+        }
+    };
+
+    // Puts the instances that are done warming up into the render.
+    auto joinWarming = [&]
+    {
+        for (auto it = warming.begin(); it != warming.end();)
+        {
+            WarmingInstance& w = **it;
+
+            if (!w.done)
+            {
+                ++it;
+                continue;
+            }
+
+            if (w.thread.joinable())
+                w.thread.join();
+
+            Effect[w.index] = w.effect;
+            activity[w.index].wake();
+
+            releaseEvents(w.index, w.held_events);
+
+            host_stats.stage(StatsStage::Preroll).record_between(w.start, w.end);
+            host_stats.add(StatsCounter::PrerollFrames, w.frames);
+
+            it = warming.erase(it);
+        }
+    };
+
+    // Whether any port is played on instance `index`.
+    auto instanceNeeded = [&](unsigned index) -> bool
+    {
+        for (unsigned port = 0; port < Effect.size(); ++port)
+        {
+            if (foldedInstance(port) == index)
+                return true;
+        }
+
+        return false;
+    };
+
+    // Opens the secondary instances and starts them, laying out the buffers
+    // for the current block size. With lazy instances, only ports that have
+    // events get theirs; otherwise every instance a port is folded onto, so
+    // `!instanceNeeded(i)` keeps the ones folding left without a port
+    // closed. An instance opened once the others are running warms up in
+    // the background with the pre-roll settings; the events for its port
+    // are held until it joins the render, then played at the start of its
+    // first block.
+    auto startInstances = [&]() -> bool
+    {
+        bool running = State.size() != 0;
+
+        joinWarming();
+
+        for (unsigned i = 1; i < Effect.size(); ++i)
+        {
+            if (Effect[i] || instanceWarming(i) || (lazy_instances ? port_events[i].empty() : !instanceNeeded(i)))
+                continue;
+
+            AEffect* effect = openInstance(i);
+
+            if (effect == nullptr)
+                return false;
+
+            if (running)
+                startInstance(effect);
+
+            if (running && need_idle && preroll_done)
+            {
+                // Next to the render only where the instances may render
+                // in parallel, see WarmingInstance.
+                std::vector<AEffect*> effects = Effect;
+
+                for (const auto& other : warming)
+                    effects[other->index] = other->effect;
+
+                effects[i] = effect;
+
+                std::mutex* block_mutex = (parallel_render && distinctInstances(effects.data(), (unsigned)effects.size())) ? nullptr : &instance_mutex;
+
+                auto w = std::make_unique<WarmingInstance>();
+
+                w->index = i;
+                w->effect = effect;
+                w->start = StatsClock::now();
+                w->thread = std::thread([warmup = w.get(), num_inputs = (uint32_t)Effect[0]->numInputs, num_outputs = (uint32_t)Effect[0]->numOutputs, block_size = BlockSize, settings = preroll, double_samples = double_precision, block_mutex]
+                    {
+                        if (double_samples)
+                            runWarmup<double>(*warmup, num_inputs, num_outputs, block_size, settings, block_mutex);
+                        else
+                            runWarmup<float>(*warmup, num_inputs, num_outputs, block_size, settings, block_mutex);
+                    });
+
+                warming.push_back(std::move(w));
+                continue;
+            }
+
+            Effect[i] = effect;
+
+            if (running)
+                activity[i].wake();
+        }
+
+        for (const auto& w : warming)
+            holdEvents(w->index, w->held_events);
+
+        // Initialize the lists and the sample buffer.
+        if (!running)
+        {
+            for (AEffect* effect : Effect)
+            {
+                if (effect)
+                    startInstance(effect);
+            }
+
+            {
+                size_t output_count = (size_t)Effect[0]->numOutputs * Effect.size();
+
+                channel_stride = BlockSize + MIXDOWN_CHANNEL_PADDING;
+
+                size_t sample_size = double_precision ? sizeof(double) : sizeof(float);
+
+                {
+                    size_t buffer_size = sizeof(void*) * (Effect[0]->numInputs + output_count); // sample lists
+
+                    buffer_size += sample_size * BlockSize;                     // null input
+                    buffer_size += sample_size * channel_stride * output_count; // outputs
+
+                    State.resize(buffer_size);
+                }
+
+                auto layOut = [&](auto**& list_in, auto**& list_out, auto*& out)
+                {
+                    typedef std::remove_reference_t<decltype(*out)> Sample;
+
+                    list_in = (Sample**)State.data();
+                    list_out = list_in + Effect[0]->numInputs;
+
+                    Sample* null_input = (Sample*)(list_out + output_count);
+
+                    out = null_input + BlockSize;
+
+                    for (uint32_t i = 0; i < (uint32_t)Effect[0]->numInputs; ++i)
+                        list_in[i] = null_input;
+
+                    for (size_t i = 0; i < output_count; ++i)
+                        list_out[i] = out + (channel_stride * i);
+
+                    memset(null_input, 0, BlockSize * sizeof(Sample));
+                };
+
+                float_list_in = float_list_out = nullptr;
+                float_out = nullptr;
+                double_list_in = double_list_out = nullptr;
+                double_out = nullptr;
+
+                if (double_precision)
+                    layOut(double_list_in, double_list_out, double_out);
+                else
+                    layOut(float_list_in, float_list_out, float_out);
+
+                sizeReplyBuffers();
+            }
+
+            // Closed instances are mixed as the silence of their zeroed buffers.
+            for (unsigned i = 0; i < Effect.size(); ++i)
+            {
+                activity[i].wake();
+                activity[i].sleeping = Effect[i] == nullptr;
+            }
+        }
+
+        return true;
+    };
+
+    auto wakeInstances = [&]
+    {
+        for (unsigned i = 0; i < Effect.size(); ++i)
+        {
+            if (Effect[i])
+                activity[i].wake();
+        }
+    };
+
+    // Closes a secondary instance between renders, its zeroed buffers are
+    // mixed like those of a sleeping one.
+    auto closeInstance = [&](unsigned index)
+    {
+        if (State.size())
+        {
+            Effect[index]->dispatcher(Effect[index], effStopProcess, 0, 0, 0, 0);
+            Effect[index]->dispatcher(Effect[index], effMainsChanged, 0, 0, 0, 0);
+        }
+
+        Effect[index]->dispatcher(Effect[index], effClose, 0, 0, 0, 0);
+        Effect[index] = nullptr;
+
+        if (State.size())
+        {
+            uint32_t num_outputs = (uint32_t)Effect[0]->numOutputs;
+
+            withSampleLists([&](auto**, auto** outputs)
+                {
+                    for (uint32_t channel = 0; channel < num_outputs; ++channel)
+                        memset(outputs[num_outputs * index + channel], 0, channel_stride * sizeof(**outputs));
+                });
+
+            activity[index].wake();
+            activity[index].sleeping = true;
+        }
+    };
+
+    // Closes a lazily opened instance that stayed silent without events for
+    // `idle_close_ms`, it is opened again by the next event for its port.
+    auto closeIdleInstances = [&]
+    {
+        uint64_t idle_frames = (uint64_t)idle_close_ms * SampleRate / 1000;
+
+        for (unsigned i = 1; i < Effect.size(); ++i)
+        {
+            if (Effect[i] == nullptr || activity[i].silent_frames < idle_frames)
+                continue;
+
+            closeInstance(i);
+
+            host_stats.add(StatsCounter::InstancesClosedIdle, 1);
+        }
+    };
+
+    // One thread per instance, the command thread being one of them, but no
+    // more than the machine has cores.
+    auto createRenderPool = [&]
+    {
+        unsigned threads = std::thread::hardware_concurrency();
+        unsigned instance_count = (unsigned)Effect.size();
+
+        if (threads == 0 || threads > instance_count)
+            threads = instance_count;
+
+        render_pool = std::make_unique<RenderPool>(threads - 1);
+    };
+
+    // Waits for the background pre-roll, which owns the instances until then.
+    auto finishPreroll = [&]
+    {
+        if (!preroll_thread.joinable())
+            return;
+
+        preroll_thread.join();
+
+        host_stats.stage(StatsStage::Preroll).record_between(preroll_start, preroll_end);
+        host_stats.add(StatsCounter::PrerollFrames, preroll_frames);
+    };
+
+    {
+        Effect[0] = Main(plugin.master);
+
+        if ((Effect[0] == nullptr) || (Effect[0]->magic != kEffectMagic))
+        {
+            code = 8;
+            goto exit;
+        }
+
+        Effect[0]->user = &effectData[0];
+        Effect[0]->dispatcher(Effect[0], effOpen, 0, 0, 0, 0);
+
+        if ((Effect[0]->dispatcher(Effect[0], effGetPlugCategory, 0, 0, 0, 0) != kPlugCategSynth) || (Effect[0]->dispatcher(Effect[0], effCanDo, 0, 0, (void*)"receiveVstMidiEvent", 0) < 1))
+        {
+            code = 9;
+            goto exit;
+        }
+    }
+
+    max_num_outputs = (uint32_t)std::min(Effect[0]->numOutputs, (VstInt32)2);
+
+    {
+        char name_string[256] = { 0 };
+        char vendor_string[256] = { 0 };
+        char product_string[256] = { 0 };
+
+        uint32_t name_string_length;
+        uint32_t vendor_string_length;
+        uint32_t product_string_length;
+        uint32_t vendor_version;
+        uint32_t unique_id;
+
+        Effect[0]->dispatcher(Effect[0], effGetEffectName, 0, 0, &name_string, 0);
+        Effect[0]->dispatcher(Effect[0], effGetVendorString, 0, 0, &vendor_string, 0);
+        Effect[0]->dispatcher(Effect[0], effGetProductString, 0, 0, &product_string, 0);
+
+        name_string_length = (uint32_t)::strlen(name_string);
+        vendor_string_length = (uint32_t)::strlen(vendor_string);
+        product_string_length = (uint32_t)::strlen(product_string);
+        vendor_version = (uint32_t)Effect[0]->dispatcher(Effect[0], effGetVendorVersion, 0, 0, 0, 0);
+        unique_id = (uint32_t)Effect[0]->uniqueID;
+
+        put_code(0);
+        put_code(name_string_length);
+        put_code(vendor_string_length);
+        put_code(product_string_length);
+        put_code(vendor_version);
+        put_code(unique_id);
+        put_code(max_num_outputs);
+
+        if (name_string_length)
+            put_bytes(name_string, name_string_length);
+
+        if (vendor_string_length)
+            put_bytes(vendor_string, vendor_string_length);
+
+        if (product_string_length)
+            put_bytes(product_string, product_string_length);
+    }
+
+    for (;;)
+    {
+        auto command = static_cast<VSTHostCommand>(get_code());
+
+        if (ack_interval)
+            command_sequence = get_code();
+
+        if (command == VSTHostCommand::Exit)
+            break;
+
+        // Timed from the command word to the last byte of the reply, so
+        // payload reads and output writes are included.
+        StatsClock::time_point command_start = StatsClock::now();
+
+        std::unique_lock<std::mutex> instances_lock(instance_mutex, std::defer_lock);
+
+        if (usesInstances(command))
+        {
+            // A render leaves the instances that are still warming up out.
+            bool render = command == VSTHostCommand::RenderSamples || command == VSTHostCommand::RenderJob;
+
+            finishPreroll();
+
+            if (!render)
+                waitWarming();
+
+            instances_lock.lock();
+
+            if (!render)
+                joinWarming();
+        }
+
+        // Plugins may ask for idle calls at any time, not just on effOpen.
+        if (need_idle && !idle_scheduler)
+            idle_scheduler = std::make_unique<IdleScheduler>(instance_mutex, Effect, std::chrono::milliseconds(IDLE_INTERVAL), host_stats.stage(StatsStage::Idle));
+
+        switch (command)
+        {
+        case VSTHostCommand::GetChunk: // Get Chunk
+        {
+            getChunk(Effect[0], chunk);
+
+            put_reply(0);
+            put_code((uint32_t)chunk.size());
+            put_bytes(chunk.data(), (uint32_t)chunk.size());
+            break;
+        }
+
+        case VSTHostCommand::SetChunk: // Set Chunk
+        {
+            uint32_t size = get_code();
+            chunk.resize(size);
+            if (size)
+                get_bytes(chunk.data(), size);
+
+            for (AEffect* effect : Effect)
+                setChunk(effect, chunk);
+
+            if (instance_pool)
+                instance_pool->set_chunk(chunk);
+
+            // A new program may sound without any event.
+            wakeInstances();
+
+            put_ack();
+            break;
+        }
+
+        case VSTHostCommand::HasEditor: // Has Editor
+        {
+            uint32_t has_editor = (plugin.edit && (Effect[0]->flags & effFlagsHasEditor)) ? 1u : 0u;
+
+            put_reply(0);
+            put_code(has_editor);
+            break;
+        }
+
+        case VSTHostCommand::DisplayEditorModal: // Display Editor Modal
+        {
+            if (plugin.edit && (Effect[0]->flags & effFlagsHasEditor))
+            {
+                plugin.edit(Effect[0]);
+
+                getChunk(Effect[0], chunk);
+
+                for (unsigned i = 1; i < Effect.size(); ++i)
+                    setChunk(Effect[i], chunk);
+
+                if (instance_pool)
+                    instance_pool->set_chunk(chunk);
+
+                wakeInstances();
+            }
+
+            put_reply(0);
+            break;
+        }
+
+        case VSTHostCommand::SetSampleRate: // Set Sample Rate
+        {
+            uint32_t size = get_code();
+
+            if (size != sizeof(SampleRate))
+            {
+                code = 10;
+                goto exit;
+            }
+
+            SampleRate = get_code();
+
+            put_ack();
+            break;
+        }
+
+        case VSTHostCommand::SetBlockSize: // Set Block Size, takes effect on the next render
+        {
+            uint32_t size = get_code();
+
+            if (size != sizeof(BlockSize))
+            {
+                code = 15;
+                goto exit;
+            }
+
+            uint32_t block_size = get_code();
+
+            if (block_size < MIN_BLOCK_SIZE)
+                block_size = MIN_BLOCK_SIZE;
+            else if (block_size > MAX_BLOCK_SIZE)
+                block_size = MAX_BLOCK_SIZE;
+
+            if (!ringFits(block_size, replyChannels(), OutputFormat, output_layout))
+                block_size = BlockSize;
+
+            // Instances only accept a new block size while suspended, the
+            // buffers are laid out again by the next render.
+            if (block_size != BlockSize && State.size())
+            {
+                for (unsigned i = 0; i < Effect.size(); ++i)
+                {
+                    if (Effect[i])
+                    {
+                        Effect[i]->dispatcher(Effect[i], effStopProcess, 0, 0, 0, 0);
+                        Effect[i]->dispatcher(Effect[i], effMainsChanged, 0, 0, 0, 0);
+                    }
+                }
+
+                State.resize(0);
+            }
+
+            BlockSize = block_size;
+
+            put_reply(0);
+            put_code(BlockSize);
+            break;
+        }
+
+        case VSTHostCommand::Reset: // Reset, swapping in warm instances when the pool is enabled
+        {
+            // Lazy instances that were never needed stay closed.
+            std::vector<uint8_t> was_open(Effect.size(), lazy_instances ? 0 : 1);
+
+            for (unsigned i = (unsigned)Effect.size(); i-- > 0;)
+            {
+                if (Effect[i] == nullptr)
+                    continue;
+
+                was_open[i] = 1;
+
+                if (State.size())
+                    Effect[i]->dispatcher(Effect[i], effStopProcess, 0, 0, 0, 0);
+
+                if (instance_pool)
+                    instance_pool->retire(Effect[i]);
+                else
+                    Effect[i]->dispatcher(Effect[i], effClose, 0, 0, 0, 0);
+
+                Effect[i] = nullptr;
+            }
+
+            State.resize(0);
+
+            freeChain();
+
+            Effect[0] = openInstance(0);
+
+            if (!Effect[0])
+            {
+                code = 8;
+                goto exit;
+            }
+
+            // The others are opened by the next render if their spares are not ready yet.
+            if (instance_pool)
+            {
+                for (unsigned i = 1; i < Effect.size(); ++i)
+                {
+                    if (was_open[i])
+                        Effect[i] = instance_pool->take(i);
+                }
+            }
+
+            put_ack();
+            break;
+        }
+
+        case VSTHostCommand::SoftReset: // Silence every instance without reopening it, keeping loaded samples
+        {
+            uint32_t flags = get_code();
+
+            if ((flags & SOFT_RESET_CYCLE_MAINS) && State.size())
+            {
+                for (unsigned i = 0; i < Effect.size(); ++i)
+                {
+                    if (Effect[i])
+                    {
+                        Effect[i]->dispatcher(Effect[i], effStopProcess, 0, 0, 0, 0);
+                        Effect[i]->dispatcher(Effect[i], effMainsChanged, 0, 0, 0, 0);
+                        Effect[i]->dispatcher(Effect[i], effMainsChanged, 0, 1, 0, 0);
+                        Effect[i]->dispatcher(Effect[i], effStartProcess, 0, 0, 0, 0);
+                    }
+                }
+            }
+
+            freeChain();
+
+            for (unsigned i = 0; i < Effect.size(); ++i)
+            {
+                if (Effect[i])
+                    queuePanic(i);
+            }
+
+            put_ack();
+            break;
+        }
+
+        case VSTHostCommand::SendMIDIEvent: // Send MIDI Event
+        {
+            uint32_t b = get_code();
+
+            unsigned port = clampPort((b & 0x7F000000) >> 24);
+
+            queueMidiEvent(port, b, 0);
+
+            put_ack();
+            break;
+        }
+
+        case VSTHostCommand::SendSysexEvent: // Send System Exclusive Event
+        {
+            uint32_t size = get_code();
+            unsigned port = clampPort(size >> 24);
+            size &= 0xFFFFFF;
+
+            myVstEvent* ev = queueSysexEvent(port, size);
+
+            if (ev != nullptr)
+                get_bytes(ev->ev.sysexEvent.sysexDump, size);
+            else
+                skip_bytes(size);
+
+            put_ack();
+            break;
+        }
+
+        case VSTHostCommand::RenderSamples: // Render Samples
+        case VSTHostCommand::RenderJob: // Render Samples with its events in the same message, replies with the audio only
+        {
+            uint32_t SampleCount = get_code();
+
+            if (command == VSTHostCommand::RenderJob)
+            {
+                uint32_t size = get_code();
+
+                event_batch.resize(size);
+
+                if (size)
+                    get_bytes(event_batch.data(), size);
+
+                if (!queueEventBatch(event_batch.data(), size))
+                {
+                    code = 14;
+                    goto exit;
+                }
+            }
+
+            // The events are queued first, lazy instances open for the ports they address.
+            if (!startInstances())
+            {
+                code = 11;
+                goto exit;
+            }
+
+            RenderPool* pool = (parallel_render && distinctInstances(Effect.data(), (unsigned)Effect.size())) ? render_pool.get() : nullptr;
+
+            if (need_idle && !preroll_done)
+            {
+                preroll_start = StatsClock::now();
+
+                uint32_t frames = 0;
+
+                withSampleLists([&](auto** inputs, auto** outputs) { frames = runPreroll(Effect.data(), 0, (unsigned)Effect.size(), inputs, outputs, (uint32_t)Effect[0]->numOutputs, BlockSize, preroll, pool, nullptr); });
+
+                host_stats.stage(StatsStage::Preroll).record_since(preroll_start);
+                host_stats.add(StatsCounter::PrerollFrames, frames);
+
+                preroll_done = true;
+            }
+
+            // Events are handed out block by block, so the queues have to be
+            // in timestamp order first.
+            next_event.assign(Effect.size(), 0);
+            block_dispatched.assign(Effect.size(), nullptr);
+
+            for (unsigned i = 0; i < Effect.size(); ++i)
+                port_events[i].sort();
+
+            PipeAudioOutput pipe_output;
+            RingAudioOutput ring_output(audio_ring);
+
+            AudioOutput& output = audio_ring.is_open() ? static_cast<AudioOutput&>(ring_output) : pipe_output;
+
+            if (command != VSTHostCommand::RenderJob)
+                put_reply(0);
+
+            if (State.size())
+            {
+                uint32_t block_start = 0;
+
+                do
+                {
+                    unsigned SamplesToDo = std::min(SampleCount, BlockSize);
+
+                    uint32_t num_outputs = (uint32_t)Effect[0]->numOutputs;
+
+                    StatsClock::time_point dispatch_start = StatsClock::now();
+
+                    for (unsigned i = 0; i < Effect.size(); ++i)
+                    {
+                        if (Effect[i] == nullptr)
+                        {
+                            block_dispatched[i] = nullptr;
+                            continue;
+                        }
+
+                        block_dispatched[i] = dispatchBlockEvents(Effect[i], i, next_event[i], block_start, SamplesToDo, SamplesToDo == SampleCount);
+
+                        if (block_dispatched[i])
+                            activity[i].wake();
+                    }
+
+                    // Later idle calls come from the idle thread, between commands.
+                    // The first one is made here, followed by the events of the
+                    // block again for plugins that ignored them until then.
+                    if (need_idle && block_start == 0 && !idle_started)
+                    {
+                        for (AEffect* effect : Effect)
+                        {
+                            if (effect)
+                                effect->dispatcher(effect, DECLARE_VST_DEPRECATED(effIdle), 0, 0, 0, 0);
+                        }
+
+                        for (unsigned i = 0; i < Effect.size(); ++i)
+                        {
+                            if (block_dispatched[i])
+                                Effect[i]->dispatcher(Effect[i], effProcessEvents, 0, 0, block_dispatched[i], 0);
+                        }
+
+                        idle_started = true;
+                    }
+
+                    host_stats.stage(StatsStage::EventDispatch).record_since(dispatch_start);
+
+                    if (SamplesToDo == 0)
+                        break;
+
+                    withSampleLists([&](auto** inputs, auto** outputs) { renderInstances(Effect.data(), 0, (unsigned)Effect.size(), inputs, outputs, num_outputs, (VstInt32)SamplesToDo, pool, activity.data(), true); });
+
+                    StatsClock::time_point mixdown_start = StatsClock::now();
+
+                    // Sleeping instances at either end are left out of the sum,
+                    // the ones in between contribute their zeroed buffers.
+                    unsigned first_awake = 0;
+                    unsigned last_awake = (unsigned)Effect.size();
+
+                    while (first_awake < last_awake && activity[first_awake].sleeping)
+                        first_awake++;
+
+                    while (last_awake > first_awake && activity[last_awake - 1].sleeping)
+                        last_awake--;
+
+                    const void* reply = sample_buffer.data();
+
+                    uint32_t reply_channels = replyChannels();
+
+                    if (double_precision)
+                    {
+                        // Mixed in double as well, only the conversion to the output format rounds.
+                        assembleBlock(double_sample_buffer.data(), double_out, channel_stride, num_outputs, max_num_outputs, (unsigned)Effect.size(), first_awake, last_awake, output_layout, SamplesToDo);
+
+                        convert_samples_double(converted_buffer.data(), double_sample_buffer.data(), SamplesToDo * reply_channels, OutputFormat, Dither);
+
+                        reply = converted_buffer.data();
+                    }
+                    else
+                    {
+                        assembleBlock(sample_buffer.data(), float_out, channel_stride, num_outputs, max_num_outputs, (unsigned)Effect.size(), first_awake, last_awake, output_layout, SamplesToDo);
+
+                        if (OutputFormat != SampleFormat::Float32)
+                        {
+                            convert_samples(converted_buffer.data(), sample_buffer.data(), SamplesToDo * reply_channels, OutputFormat, Dither);
+
+                            reply = converted_buffer.data();
+                        }
+                    }
+
+                    if (silence_skipping != SILENCE_SKIP_OFF || (lazy_instances && idle_close_ms))
+                        withSampleLists([&](auto**, auto** outputs) { updateActivity(activity.data(), Effect.data(), (unsigned)Effect.size(), outputs, num_outputs, BlockSize, SamplesToDo, silence_skipping); });
+
+                    StatsClock::time_point write_start = StatsClock::now();
+
+                    host_stats.stage(StatsStage::Mixdown).record_between(mixdown_start, write_start);
+
+                    uint32_t frame_bytes = reply_channels * sample_format_bytes(OutputFormat);
+
+                    bool written = (output_layout & OUTPUT_LAYOUT_PLANAR) ? output.write_block(reply, SamplesToDo, frame_bytes) : output.write(reply, SamplesToDo, frame_bytes);
+
+                    if (!written)
+                    {
+                        code = 13;
+                        goto exit;
+                    }
+
+                    host_stats.stage(StatsStage::OutputWrite).record_since(write_start);
+
+                    host_stats.add(StatsCounter::FramesRendered, SamplesToDo);
+
+                    block_start += SamplesToDo;
+                    SampleCount -= SamplesToDo;
+                } while (SampleCount);
+
+                output.finish();
+
+                if (lazy_instances && idle_close_ms)
+                    closeIdleInstances();
+            }
+
+            // Still acknowledges the job and the commands before it.
+            if (command == VSTHostCommand::RenderJob && ack_interval)
+            {
+                if (events_dropped != events_dropped_reported)
+                    put_reply(ACK_EVENTS_DROPPED);
+                else
+                    put_reply(0);
+            }
+
+            freeChain();
+            break;
+        }
+
+        case VSTHostCommand::SendMIDIEventWithTimestamp: // Send MIDI Event, with timestamp
+        {
+            uint32_t b = get_code();
+            uint32_t timestamp = get_code();
+
+            unsigned port = clampPort((b & 0x7F000000) >> 24);
+
+            queueMidiEvent(port, b, timestamp);
+
+            put_ack();
+            break;
+        }
+
+        case VSTHostCommand::SendSysexEventWithTimestamp: // Send System Exclusive Event, with timestamp
+        {
+            uint32_t size = get_code();
+            unsigned port = clampPort(size >> 24);
+            size &= 0xFFFFFF;
+
+            uint32_t timestamp = get_code();
+
+            myVstEvent* ev = queueSysexEvent(port, size);
+
+            if (ev != nullptr)
+            {
+                ev->ev.sysexEvent.deltaFrames = (VstInt32)timestamp;
+
+                get_bytes(ev->ev.sysexEvent.sysexDump, size);
+            }
+            else
+                skip_bytes(size);
+
+            put_ack();
+            break;
+        }
+
+        case VSTHostCommand::MapAudioRing: // Map shared audio ring, zero frames falls back to the pipe
+        {
+            uint32_t capacity_frames = get_code();
+
+            audio_ring.destroy();
+
+            if (capacity_frames)
+            {
+                uint64_t capacity = (uint64_t)capacity_frames * replyChannels() * sample_format_bytes(OutputFormat);
+
+                if (capacity <= 0x7FFFFFFF)
+                    audio_ring.create((uint32_t)capacity);
+            }
+
+            const std::string& ring_name = audio_ring.name();
+
+            uint32_t ring_name_length = (uint32_t)ring_name.size();
+
+            put_reply(0);
+            put_code(ring_name_length);
+            put_code(audio_ring.capacity());
+
+            if (ring_name_length)
+                put_bytes(ring_name.data(), ring_name_length);
+            break;
+        }
+
+        case VSTHostCommand::SendEventBatch: // Send packed MIDI and System Exclusive Events, acknowledged once
+        {
+            uint32_t size = get_code();
+
+            event_batch.resize(size);
+
+            if (size)
+                get_bytes(event_batch.data(), size);
+
+            if (!queueEventBatch(event_batch.data(), size))
+            {
+                code = 14;
+                goto exit;
+            }
+
+            put_ack();
+            break;
+        }
+
+        case VSTHostCommand::SetParallelRender: // Render the instances concurrently, for plugins that allow it
+        {
+            uint32_t enable = get_code();
+
+            parallel_render = enable != 0;
+
+            if (parallel_render && !render_pool)
+                createRenderPool();
+
+            put_reply(0);
+            put_code(parallel_render ? 1u : 0u);
+            break;
+        }
+
+        case VSTHostCommand::SetOutputFormat: // Set the sample format of rendered audio, unknown formats are ignored
+        {
+            uint32_t format = get_code();
+            uint32_t flags = get_code();
+
+            if (format <= (uint32_t)SampleFormat::Float64 && ringFits(BlockSize, replyChannels(), static_cast<SampleFormat>(format), output_layout))
+                OutputFormat = static_cast<SampleFormat>(format);
+
+            Dither.enabled = (flags & OUTPUT_FORMAT_DITHER) != 0;
+
+            put_reply(0);
+            put_code((uint32_t)OutputFormat);
+            break;
+        }
+
+        case VSTHostCommand::SetPipelineMode: // Set the acknowledgement interval of pipelined mode, zero leaves it
+        {
+            uint32_t interval = get_code();
+
+            // Answered in the framing the client used to send the command.
+            put_reply(0);
+            put_code(interval);
+
+            ack_interval = interval;
+            ack_pending = 0;
+            break;
+        }
+
+        case VSTHostCommand::Sync: // Acknowledge everything received so far
+        {
+            put_reply(0);
+            break;
+        }
+
+        case VSTHostCommand::SetInstancePool: // Keep warm spare instances for Reset, for plugins that can be opened off the main thread
+        {
+            uint32_t enable = get_code();
+
+            if (!enable)
+                instance_pool.reset();
+            else if (!instance_pool)
+            {
+                instance_pool = std::make_unique<InstancePool>(Main, plugin.master, effectData, (unsigned)Effect.size(), setChunk);
+                instance_pool->set_chunk(chunk);
+            }
+
+            put_reply(0);
+            put_code(instance_pool ? 1u : 0u);
+            break;
+        }
+
+        case VSTHostCommand::SetPreroll: // Set the pre-roll of idle-driven plugins, optionally starting it in the background
+        {
+            uint32_t frames = get_code();
+            uint32_t silent_blocks = get_code();
+            uint32_t flags = get_code();
+
+            preroll.frames = frames;
+            preroll.silent_blocks = silent_blocks;
+
+            // The pre-roll thread owns the instances until the next command
+            // that needs them, events are queued meanwhile. It only runs
+            // through the instances open by now, which with lazy instances
+            // are the first one and those of ports that already have events;
+            // the others warm up when they are opened.
+            if ((flags & PREROLL_BACKGROUND) && need_idle && !preroll_done)
+            {
+                if (!startInstances())
+                {
+                    code = 11;
+                    goto exit;
+                }
+
+                AEffect* const* effects = Effect.data();
+                unsigned count = (unsigned)Effect.size();
+                uint32_t num_outputs = (uint32_t)Effect[0]->numOutputs;
+                uint32_t block_size = BlockSize;
+                RenderPool* pool = (parallel_render && distinctInstances(Effect.data(), (unsigned)Effect.size())) ? render_pool.get() : nullptr;
+
+                preroll_done = true;
+                preroll_start = StatsClock::now();
+
+                withSampleLists([&](auto** inputs, auto** outputs)
+                    {
+                        preroll_thread = std::thread([&instance_mutex, &preroll_frames, &preroll_end, effects, count, inputs, outputs, num_outputs, block_size, settings = preroll, pool]
+                            {
+                                std::lock_guard<std::mutex> lock(instance_mutex);
+
+                                preroll_frames = runPreroll(effects, 0, count, inputs, outputs, num_outputs, block_size, settings, pool, nullptr);
+                                preroll_end = StatsClock::now();
+                            });
+                    });
+            }
+
+            put_reply(0);
+            put_code(preroll_thread.joinable() ? 1u : 0u);
+            break;
+        }
+
+        case VSTHostCommand::SetSilenceSkipping: // Skip instances that went silent until their next event, see SILENCE_SKIP_*
+        {
+            uint32_t mode = get_code();
+
+            silence_skipping = std::min(mode, (uint32_t)SILENCE_SKIP_ANY);
+
+            // Sleeping instances start over under the new rules.
+            wakeInstances();
+
+            put_reply(0);
+            put_code(silence_skipping);
+            break;
+        }
+
+        case VSTHostCommand::SetInstanceCount: // Set the number of instances, one per event port; they are opened by the next render
+        {
+            uint32_t count = get_code();
+
+            count = std::min(std::max(count, 1u), (uint32_t)MAX_INSTANCE_COUNT);
+
+            // Stems have every instance in a reply frame.
+            if ((output_layout & OUTPUT_LAYOUT_STEMS) && !ringFits(BlockSize, max_num_outputs * count, OutputFormat, output_layout))
+                count = (uint32_t)Effect.size();
+
+            if (count != Effect.size())
+            {
+                // Like a block size change, every instance is suspended and
+                // the buffers are laid out again by the next render. The ones
+                // past the new count are closed.
+                for (unsigned i = (unsigned)Effect.size(); i-- > 0;)
+                {
+                    if (Effect[i] == nullptr)
+                        continue;
+
+                    if (State.size())
+                    {
+                        Effect[i]->dispatcher(Effect[i], effStopProcess, 0, 0, 0, 0);
+                        Effect[i]->dispatcher(Effect[i], effMainsChanged, 0, 0, 0, 0);
+                    }
+
+                    if (i >= count)
+                    {
+                        Effect[i]->dispatcher(Effect[i], effClose, 0, 0, 0, 0);
+                        Effect[i] = nullptr;
+                    }
+                }
+
+                State.resize(0);
+
+                // Pending events of dropped ports go where they would have
+                // been clamped to.
+                for (unsigned port = count; port < port_events.size(); ++port)
+                {
+                    for (size_t i = 0; i < port_events[port].size(); ++i)
+                        port_events[count - 1].push(port_events[port].at(i));
+                }
+
+                Effect.resize(count, nullptr);
+                activity.resize(count);
+                port_events.resize(count);
+                block_events.resize(count);
+
+                if (instance_pool)
+                {
+                    instance_pool = std::make_unique<InstancePool>(Main, plugin.master, effectData, count, setChunk);
+                    instance_pool->set_chunk(chunk);
+                }
+
+                if (render_pool)
+                    createRenderPool();
+            }
+
+            put_reply(0);
+            put_code(count);
+            break;
+        }
+
+        case VSTHostCommand::SetLazyInstances: // Open secondary instances on the first event for their port, optionally closing them after an idle period
+        {
+            uint32_t enable = get_code();
+            uint32_t close_ms = get_code();
+
+            // Turning it off opens the missing instances by the next render,
+            // the open ones stay open either way.
+            lazy_instances = enable != 0;
+            idle_close_ms = close_ms;
+
+            put_reply(0);
+            put_code(lazy_instances ? 1u : 0u);
+            break;
+        }
+
+        case VSTHostCommand::SetPortFolding: // Play several ports on one instance with remapped MIDI channels, an empty table turns it off
+        {
+            uint32_t count = get_code();
+
+            std::vector<PortFold> folds(std::min(count, (uint32_t)MAX_INSTANCE_COUNT));
+
+            bool valid = count <= MAX_INSTANCE_COUNT;
+
+            for (uint32_t port = 0; port < count; ++port)
+            {
+                PortFold fold;
+
+                uint32_t instance = get_code();
+                get_bytes(fold.channels, sizeof(fold.channels));
+
+                fold.instance = (uint8_t)std::min(instance, (uint32_t)MAX_INSTANCE_COUNT - 1);
+
+                for (uint8_t channel : fold.channels)
+                    valid = valid && channel < 16;
+
+                valid = valid && instance < MAX_INSTANCE_COUNT;
+
+                if (port < folds.size())
+                    folds[port] = fold;
+            }
+
+            // A malformed table leaves the current one in place. Events
+            // already queued keep the instance they were bucketed for.
+            if (valid)
+            {
+                port_folds.swap(folds);
+
+                // Instances no port is played on any more give back their memory.
+                for (unsigned i = 1; i < Effect.size(); ++i)
+                {
+                    if (Effect[i] && !instanceNeeded(i) && port_events[i].empty())
+                        closeInstance(i);
+                }
+            }
+
+            uint32_t folded = 0;
+
+            for (unsigned port = 0; port < Effect.size(); ++port)
+                folded += foldedInstance(port) != port ? 1u : 0u;
+
+            // Channels past what the plugin listens to are the client's to avoid.
+            uint32_t midi_channels = (uint32_t)Effect[0]->dispatcher(Effect[0], effGetNumMidiInputChannels, 0, 0, 0, 0);
+
+            if (midi_channels == 0 || midi_channels > 16)
+                midi_channels = 16;
+
+            put_reply(0);
+            put_code(folded);
+            put_code(midi_channels);
+            break;
+        }
+
+        case VSTHostCommand::SetProcessPrecision: // Render through processDoubleReplacing when the plugin supports it, see VstProcessPrecision
+        {
+            uint32_t precision = get_code();
+
+            bool supported = (Effect[0]->flags & effFlagsCanDoubleReplacing) && Effect[0]->processDoubleReplacing;
+            bool use_double = precision == kVstProcessPrecision64 && supported;
+
+            // Plugins only switch precision while suspended, like a block
+            // size change. The buffers are laid out again by the next render.
+            if (use_double != double_precision && State.size())
+            {
+                for (unsigned i = 0; i < Effect.size(); ++i)
+                {
+                    if (Effect[i])
+                    {
+                        Effect[i]->dispatcher(Effect[i], effStopProcess, 0, 0, 0, 0);
+                        Effect[i]->dispatcher(Effect[i], effMainsChanged, 0, 0, 0, 0);
+                    }
+                }
+
+                State.resize(0);
+            }
+
+            double_precision = use_double;
+
+            put_reply(0);
+            put_code(double_precision ? (uint32_t)kVstProcessPrecision64 : (uint32_t)kVstProcessPrecision32);
+            break;
+        }
+
+        case VSTHostCommand::SetOutputLayout: // Set the channels and layout of rendered audio, see OUTPUT_LAYOUT_*
+        {
+            uint32_t flags = get_code();
+
+            uint32_t layout = flags & (OUTPUT_LAYOUT_ALL_CHANNELS | OUTPUT_LAYOUT_STEMS | OUTPUT_LAYOUT_PLANAR);
+
+            if (layout & OUTPUT_LAYOUT_STEMS)
+                layout |= OUTPUT_LAYOUT_ALL_CHANNELS;
+
+            uint32_t num_outputs = (layout & OUTPUT_LAYOUT_ALL_CHANNELS) ? (uint32_t)Effect[0]->numOutputs : (uint32_t)std::min(Effect[0]->numOutputs, (VstInt32)2);
+            uint32_t channels = num_outputs * ((layout & OUTPUT_LAYOUT_STEMS) ? (uint32_t)Effect.size() : 1u);
+
+            if (ringFits(BlockSize, channels, OutputFormat, layout))
+            {
+                output_layout = layout;
+                max_num_outputs = num_outputs;
+
+                if (State.size())
+                    sizeReplyBuffers();
+            }
+
+            // A planar block is the frames of one reply block, up to the block size.
+            put_reply(0);
+            put_code(output_layout);
+            put_code(replyChannels());
+            break;
+        }
+
+        case VSTHostCommand::GetStats: // Get latency histograms and counters, see host_stats.h for the layout
+        {
+            uint32_t flags = get_code();
+
+            if (instance_pool)
+                host_stats.set(StatsCounter::InstancePoolFailures, instance_pool->failures());
+
+            host_stats.set(StatsCounter::ArenaPeakBytes, event_arena.peak());
+            host_stats.set(StatsCounter::ArenaReservedBytes, event_arena.reserved());
+            host_stats.set(StatsCounter::InstancesOpen, (uint64_t)std::count_if(Effect.begin(), Effect.end(), [](AEffect* effect) { return effect != nullptr; }));
+
+            {
+                uint64_t ports_folded = 0;
+                uint64_t folded_away = 0;
+
+                for (unsigned i = 0; i < Effect.size(); ++i)
+                {
+                    ports_folded += foldedInstance(i) != i ? 1 : 0;
+                    folded_away += (i && !instanceNeeded(i)) ? 1 : 0; // the first instance stays open
+                }
+
+                // Every folded away instance would have rendered each frame at the average cost.
+                double saved_ns = host_stats.instance_frame_ns() * (double)host_stats.value(StatsCounter::FramesRendered) * (double)folded_away;
+
+                host_stats.set(StatsCounter::PortsFolded, ports_folded);
+                host_stats.set(StatsCounter::InstancesFoldedAway, folded_away);
+                host_stats.set(StatsCounter::FoldSavedNs, (uint64_t)saved_ns);
+            }
+
+            host_stats.serialize(stats_reply);
+
+            if (flags & GET_STATS_RESET)
+                host_stats.reset();
+
+            put_reply(0);
+            put_code((uint32_t)stats_reply.size());
+            put_bytes(stats_reply.data(), (uint32_t)stats_reply.size());
+            break;
+        }
+
+        default:
+        {
+            code = 12;
+            goto exit;
+        }
+        }
+
+        if (command != VSTHostCommand::GetStats)
+            host_stats.command((uint32_t)command).record_since(command_start);
+    }
+
+exit:
+    finishPreroll();
+
+    idle_scheduler.reset();
+
+    waitWarming();
+    joinWarming();
+
+    for (unsigned i = (unsigned)Effect.size(); i-- > 0;)
+    {
+        if (Effect[i] == nullptr)
+            continue;
+
+        if (State.size())
+            Effect[i]->dispatcher(Effect[i], effStopProcess, 0, 0, 0, 0);
+
+        Effect[i]->dispatcher(Effect[i], effClose, 0, 0, 0, 0);
+    }
+
+    instance_pool.reset();
+
+    freeChain();
+
+    return code;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "aeffectx.h"
+
+#include <atomic>
+
+class HostIO;
+
+typedef AEffect* (VSTCALLBACK* main_func)(audioMasterCallback audioMaster);
+
+struct audioMasterData
+{
+    VstIntPtr effect_number;
+};
+
+// Set by the audioMaster callback once a plugin asks for effIdle calls.
+extern std::atomic<bool> need_idle;
+
+// What the command loop needs from the platform front end.
+struct HostPlugin
+{
+    main_func entry;            // VSTPluginMain of the loaded module
+    audioMasterCallback master; // handed to every instance
+    void (*edit)(AEffect* effect); // runs the editor of `effect` modally, nullptr if the platform has none
+};
+
+// Opens the first plugin instance, answers the handshake and then serves
+// VSTHostCommands over `io` until Exit or a fatal error. Every instance is
+// closed on return. The returned exit code is left for the caller to send as
+// the last word of the session, after it unloaded the module.
+unsigned runHostEngine(HostIO& io, const HostPlugin& plugin);
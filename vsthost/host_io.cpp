@@ -0,0 +1,209 @@
+#include "host_io.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#include "stdafx.h"
+#else
+#include <cerrno>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+HostIO::HostIO()
+{
+    output.reserve(BUFFER_SIZE);
+    input.resize(BUFFER_SIZE);
+}
+
+bool HostIO::write(const void* data, uint32_t size)
+{
+    if (size >= DIRECT_WRITE_SIZE)
+    {
+        Slice slices[2] = { { output.data(), output.size() }, { data, size } };
+
+        bool written = output.empty() ? write_slices(&slices[1], 1) : write_slices(slices, 2);
+
+        output.resize(0);
+
+        return written;
+    }
+
+    if (output.size() + size > BUFFER_SIZE && !flush())
+        return false;
+
+    size_t offset = output.size();
+
+    output.resize(offset + size);
+
+    memcpy(output.data() + offset, data, size);
+
+    return true;
+}
+
+bool HostIO::flush()
+{
+    if (output.empty())
+        return true;
+
+    Slice slice = { output.data(), output.size() };
+
+    bool written = write_slices(&slice, 1);
+
+    output.resize(0);
+
+    return written;
+}
+
+bool HostIO::read(void* data, uint32_t size)
+{
+    uint8_t* out = (uint8_t*)data;
+
+    while (size)
+    {
+        if (input_offset == input_size)
+        {
+            // Whatever the client waits for has to be on its way before we wait for it.
+            if (!flush())
+                return false;
+
+            input_offset = 0;
+            input_size = 0;
+
+            // Large payloads bypass the buffer.
+            if (size >= BUFFER_SIZE)
+            {
+                size_t done = read_some(out, size);
+
+                if (done == 0)
+                    return false;
+
+                out += done;
+                size -= (uint32_t)done;
+                continue;
+            }
+
+            input_size = read_some(input.data(), input.size());
+
+            if (input_size == 0)
+                return false;
+        }
+
+        size_t size_to_do = (std::min)((size_t)size, input_size - input_offset);
+
+        memcpy(out, input.data() + input_offset, size_to_do);
+
+        input_offset += size_to_do;
+        out += size_to_do;
+        size -= (uint32_t)size_to_do;
+    }
+
+    return true;
+}
+
+#ifdef _WIN32
+
+bool HandleIO::write_slices(const Slice* slices, unsigned count)
+{
+    const void* data = slices[0].data;
+    size_t size = slices[0].size;
+
+    if (count > 1)
+    {
+        gather.resize(0);
+
+        for (unsigned i = 0; i < count; ++i)
+            gather.insert(gather.end(), (const uint8_t*)slices[i].data, (const uint8_t*)slices[i].data + slices[i].size);
+
+        data = gather.data();
+        size = gather.size();
+    }
+
+    const uint8_t* bytes = (const uint8_t*)data;
+
+    while (size)
+    {
+        DWORD BytesWritten;
+
+        if (!WriteFile((HANDLE)out, bytes, (DWORD)(std::min)(size, (size_t)0x40000000), &BytesWritten, NULL) || BytesWritten == 0)
+            return false;
+
+        bytes += BytesWritten;
+        size -= BytesWritten;
+    }
+
+    return true;
+}
+
+size_t HandleIO::read_some(void* data, size_t size)
+{
+    DWORD BytesRead;
+
+    if (!ReadFile((HANDLE)in, data, (DWORD)(std::min)(size, (size_t)0x40000000), &BytesRead, NULL))
+        return 0;
+
+    return BytesRead;
+}
+
+#else
+
+bool FdIO::write_slices(const Slice* slices, unsigned count)
+{
+    iovec vectors[4];
+
+    count = (std::min)(count, 4u);
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        vectors[i].iov_base = (void*)slices[i].data;
+        vectors[i].iov_len = slices[i].size;
+    }
+
+    iovec* pending = vectors;
+
+    while (count)
+    {
+        ssize_t done = writev(out, pending, (int)count);
+
+        if (done < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return false;
+        }
+
+        // Skip what went out, a pipe may take a gathered write in parts.
+        while (count && (size_t)done >= pending->iov_len)
+        {
+            done -= (ssize_t)pending->iov_len;
+            pending++;
+            count--;
+        }
+
+        if (count)
+        {
+            pending->iov_base = (uint8_t*)pending->iov_base + done;
+            pending->iov_len -= (size_t)done;
+        }
+    }
+
+    return true;
+}
+
+size_t FdIO::read_some(void* data, size_t size)
+{
+    for (;;)
+    {
+        ssize_t done = ::read(in, data, size);
+
+        if (done >= 0)
+            return (size_t)done;
+
+        if (errno != EINTR)
+            return 0;
+    }
+}
+
+#endif
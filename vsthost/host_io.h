@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Byte stream the protocol runs over.
+//
+// Writes are buffered: small ones, like reply codes, are collected and leave
+// together with the next large payload in a single vectored write, or when
+// the host is about to wait for input. Reads are served from a buffer that is
+// refilled with whatever the client has sent so far, so a run of commands
+// costs one system call instead of one per word.
+class HostIO
+{
+public:
+    enum : uint32_t
+    {
+        BUFFER_SIZE = 64 * 1024,
+        DIRECT_WRITE_SIZE = 4096 // writes from this size on are not copied into the buffer
+    };
+
+    HostIO();
+    virtual ~HostIO() = default;
+
+    HostIO(const HostIO&) = delete;
+    HostIO& operator=(const HostIO&) = delete;
+
+    bool write(const void* data, uint32_t size);
+
+    // Reads exactly `size` bytes, sending the buffered output first if it has
+    // to wait for the client.
+    bool read(void* data, uint32_t size);
+
+    bool flush();
+
+protected:
+    struct Slice
+    {
+        const void* data;
+        size_t size;
+    };
+
+    // Writes every slice completely, in order.
+    virtual bool write_slices(const Slice* slices, unsigned count) = 0;
+
+    // Reads between one and `size` bytes, returns zero once the stream ended.
+    virtual size_t read_some(void* data, size_t size) = 0;
+
+private:
+    std::vector<uint8_t> output;
+    std::vector<uint8_t> input;
+    size_t input_offset = 0;
+    size_t input_size = 0;
+};
+
+#ifdef _WIN32
+
+// Anonymous pipes handed over as the standard handles. Pipes have no
+// gathering write, so slices are joined in a scratch buffer instead.
+class HandleIO final : public HostIO
+{
+public:
+    HandleIO(void* in, void* out) : in(in), out(out)
+    {
+    }
+
+protected:
+    bool write_slices(const Slice* slices, unsigned count) override;
+    size_t read_some(void* data, size_t size) override;
+
+private:
+    void* in;
+    void* out;
+    std::vector<uint8_t> gather;
+};
+
+#else
+
+class FdIO final : public HostIO
+{
+public:
+    FdIO(int in, int out) : in(in), out(out)
+    {
+    }
+
+protected:
+    bool write_slices(const Slice* slices, unsigned count) override;
+    size_t read_some(void* data, size_t size) override;
+
+private:
+    int in;
+    int out;
+};
+
+#endif
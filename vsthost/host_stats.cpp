@@ -0,0 +1,200 @@
+#include "host_stats.h"
+
+#include <bit>
+#include <cstring>
+
+static unsigned bucket_of(uint64_t ns)
+{
+    if (ns < 16)
+        return (unsigned)ns;
+
+    unsigned exponent = (unsigned)std::bit_width(ns) - 1;
+    unsigned sub = (unsigned)(ns >> (exponent - 2)) & 3;
+
+    return 16 + (exponent - 4) * 4 + sub;
+}
+
+static uint64_t bucket_upper_bound(unsigned bucket)
+{
+    if (bucket < 16)
+        return bucket;
+
+    unsigned exponent = (bucket - 16) / 4 + 4;
+    unsigned sub = (bucket - 16) % 4;
+
+    uint64_t width = (uint64_t)1 << (exponent - 2);
+
+    return (4 + sub) * width + (width - 1);
+}
+
+void LatencyHistogram::record(uint64_t ns)
+{
+    buckets[bucket_of(ns)]++;
+
+    samples++;
+    total_ns += ns;
+
+    if (ns > max_ns)
+        max_ns = ns;
+}
+
+uint64_t LatencyHistogram::percentile(double q) const
+{
+    if (samples == 0)
+        return 0;
+
+    uint64_t target = (uint64_t)(q * (double)samples);
+
+    if (target >= samples)
+        target = samples - 1;
+
+    uint64_t seen = 0;
+
+    for (unsigned i = 0; i < BUCKETS; ++i)
+    {
+        seen += buckets[i];
+
+        if (seen > target)
+        {
+            uint64_t bound = bucket_upper_bound(i);
+
+            return bound < max_ns ? bound : max_ns;
+        }
+    }
+
+    return max_ns;
+}
+
+void LatencyHistogram::reset()
+{
+    memset(buckets, 0, sizeof(buckets));
+
+    samples = 0;
+    total_ns = 0;
+    max_ns = 0;
+}
+
+template <typename T>
+static void append_le(std::vector<uint8_t>& out, T value)
+{
+    size_t offset = out.size();
+
+    out.resize(offset + sizeof(value));
+
+    memcpy(&out[offset], &value, sizeof(value));
+}
+
+static void append_histogram(std::vector<uint8_t>& out, StatsKind kind, uint32_t id, const LatencyHistogram& histogram)
+{
+    append_le(out, (uint32_t)kind);
+    append_le(out, id);
+    append_le(out, histogram.count());
+    append_le(out, histogram.total());
+    append_le(out, histogram.max());
+    append_le(out, histogram.percentile(0.5));
+    append_le(out, histogram.percentile(0.9));
+    append_le(out, histogram.percentile(0.99));
+}
+
+void HostStats::serialize(std::vector<uint8_t>& out) const
+{
+    out.resize(0);
+
+    append_le(out, (uint32_t)VERSION);
+
+    size_t count_offset = out.size();
+    uint32_t histogram_count = 0;
+
+    append_le(out, histogram_count);
+
+    for (uint32_t i = 0; i < MAX_COMMANDS; ++i)
+    {
+        if (commands[i].count())
+        {
+            append_histogram(out, StatsKind::Command, i, commands[i]);
+            histogram_count++;
+        }
+    }
+
+    for (uint32_t i = 0; i < MAX_INSTANCES; ++i)
+    {
+        if (instances[i].count())
+        {
+            append_histogram(out, StatsKind::Instance, i, instances[i]);
+            histogram_count++;
+        }
+    }
+
+    for (uint32_t i = 0; i < (uint32_t)StatsStage::Count; ++i)
+    {
+        if (stages[i].count())
+        {
+            append_histogram(out, StatsKind::Stage, i, stages[i]);
+            histogram_count++;
+        }
+    }
+
+    memcpy(&out[count_offset], &histogram_count, sizeof(histogram_count));
+
+    append_le(out, (uint32_t)StatsCounter::Count);
+
+    for (uint32_t i = 0; i < (uint32_t)StatsCounter::Count; ++i)
+    {
+        append_le(out, i);
+        append_le(out, counters[i]);
+    }
+
+    count_offset = out.size();
+    uint32_t instance_count = 0;
+
+    append_le(out, instance_count);
+
+    for (uint32_t i = 0; i < MAX_INSTANCES; ++i)
+    {
+        const InstanceFrames& frames = instance_frames[i];
+
+        if (frames.rendered == 0 && frames.skipped == 0)
+            continue;
+
+        uint64_t saved = frames.rendered ? (uint64_t)((double)instances[i].total() / (double)frames.rendered * (double)frames.skipped) : 0;
+
+        append_le(out, i);
+        append_le(out, frames.rendered);
+        append_le(out, frames.skipped);
+        append_le(out, saved);
+        instance_count++;
+    }
+
+    memcpy(&out[count_offset], &instance_count, sizeof(instance_count));
+}
+
+double HostStats::instance_frame_ns() const
+{
+    uint64_t total_ns = 0;
+    uint64_t rendered = 0;
+
+    for (uint32_t i = 0; i < MAX_INSTANCES; ++i)
+    {
+        total_ns += instances[i].total();
+        rendered += instance_frames[i].rendered;
+    }
+
+    return rendered ? (double)total_ns / (double)rendered : 0.0;
+}
+
+void HostStats::reset()
+{
+    for (LatencyHistogram& histogram : commands)
+        histogram.reset();
+
+    for (LatencyHistogram& histogram : instances)
+        histogram.reset();
+
+    for (LatencyHistogram& histogram : stages)
+        histogram.reset();
+
+    memset(counters, 0, sizeof(counters));
+
+    for (InstanceFrames& frames : instance_frames)
+        frames = InstanceFrames();
+}
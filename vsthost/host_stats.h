@@ -0,0 +1,163 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Latency histograms and counters of the command loop, read by GetStats.
+//
+// Histograms use four linear sub-buckets per power of two of nanoseconds,
+// which keeps recording to a few instructions and percentiles within 25%
+// of the true value over the whole range.
+typedef std::chrono::steady_clock StatsClock;
+
+class LatencyHistogram
+{
+public:
+    enum
+    {
+        BUCKETS = 256
+    };
+
+    void record(uint64_t ns);
+
+    void record_between(StatsClock::time_point start, StatsClock::time_point end)
+    {
+        record((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    }
+
+    void record_since(StatsClock::time_point start)
+    {
+        record_between(start, StatsClock::now());
+    }
+
+    uint64_t count() const { return samples; }
+    uint64_t total() const { return total_ns; }
+    uint64_t max() const { return max_ns; }
+
+    // Upper bound of the bucket holding the q-quantile, capped at the maximum.
+    uint64_t percentile(double q) const;
+
+    void reset();
+
+private:
+    uint32_t buckets[BUCKETS] = {};
+    uint64_t samples = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+};
+
+enum class StatsStage : uint32_t
+{
+    EventDispatch = 0, // effProcessEvents calls of a render
+    Mixdown,           // summing, interleaving and format conversion
+    OutputWrite,       // handing a block to the pipe or the audio ring
+    Preroll,           // warm-up audio run before the first render of idle-driven plugins
+    Idle,              // effIdle calls of the idle thread, one sample per tick
+    Count
+};
+
+enum class StatsCounter : uint32_t
+{
+    EventsQueued = 0,
+    EventsDropped,
+    ArenaPeakBytes,
+    ArenaReservedBytes,
+    FramesRendered,
+    InstancesCreated,    // opened synchronously by the command loop
+    InstancesFromPool,   // taken ready from the warm instance pool
+    InstancePoolFailures,
+    PrerollFrames,
+    InstancesOpen,       // open when the stats were taken, lazy instances included once opened
+    InstancesClosedIdle, // lazy instances closed after their idle period
+    PortsFolded,         // ports whose events are played by another port's instance
+    InstancesFoldedAway, // instances no port is played on while ports are folded
+    FoldSavedNs,         // processReplacing time the folded away instances would have taken
+    Count
+};
+
+// GetStats payload, all values little endian:
+//
+//   u32 version, u32 histogram count, then per histogram
+//     u32 kind (StatsKind), u32 id, u64 count, u64 total ns, u64 max ns,
+//     u64 p50 ns, u64 p90 ns, u64 p99 ns
+//   u32 counter count, then per counter u32 id (StatsCounter), u64 value
+//   u32 instance count, then per instance u32 index, u64 frames rendered,
+//     u64 frames skipped as silent, u64 ns saved by the skipping
+//
+// Only histograms and instances that recorded something are included. The
+// saving is estimated from the average processReplacing cost per frame of
+// the instance.
+enum class StatsKind : uint32_t
+{
+    Command = 0,  // id is the VSTHostCommand
+    Instance,     // id is the instance index, time spent in processReplacing
+    Stage         // id is the StatsStage
+};
+
+class HostStats
+{
+public:
+    enum : uint32_t
+    {
+        VERSION = 2,
+        MAX_COMMANDS = 64,
+        MAX_INSTANCES = 64
+    };
+
+    LatencyHistogram& command(uint32_t id)
+    {
+        return commands[id < MAX_COMMANDS ? id : MAX_COMMANDS - 1];
+    }
+
+    LatencyHistogram& instance(unsigned index)
+    {
+        return instances[index < MAX_INSTANCES ? index : MAX_INSTANCES - 1];
+    }
+
+    struct InstanceFrames
+    {
+        uint64_t rendered = 0;
+        uint64_t skipped = 0;
+    };
+
+    InstanceFrames& frames(unsigned index)
+    {
+        return instance_frames[index < MAX_INSTANCES ? index : MAX_INSTANCES - 1];
+    }
+
+    LatencyHistogram& stage(StatsStage id)
+    {
+        return stages[(uint32_t)id];
+    }
+
+    void set(StatsCounter id, uint64_t value)
+    {
+        counters[(uint32_t)id] = value;
+    }
+
+    void add(StatsCounter id, uint64_t value)
+    {
+        counters[(uint32_t)id] += value;
+    }
+
+    uint64_t value(StatsCounter id) const
+    {
+        return counters[(uint32_t)id];
+    }
+
+    // Average processReplacing time of one instance for one frame, over
+    // every instance that rendered.
+    double instance_frame_ns() const;
+
+    void serialize(std::vector<uint8_t>& out) const;
+    void reset();
+
+private:
+    LatencyHistogram commands[MAX_COMMANDS];
+    LatencyHistogram instances[MAX_INSTANCES];
+    LatencyHistogram stages[(uint32_t)StatsStage::Count];
+    InstanceFrames instance_frames[MAX_INSTANCES];
+
+    uint64_t counters[(uint32_t)StatsCounter::Count] = {};
+};
@@ -0,0 +1,49 @@
+#include "idle_scheduler.h"
+
+IdleScheduler::IdleScheduler(std::mutex& instance_mutex, const std::vector<AEffect*>& effects, std::chrono::milliseconds interval, LatencyHistogram& histogram)
+    : instance_mutex(instance_mutex), effects(effects), interval(interval), histogram(histogram)
+{
+    worker = std::thread(&IdleScheduler::worker_main, this);
+}
+
+IdleScheduler::~IdleScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    wake.notify_one();
+    worker.join();
+}
+
+void IdleScheduler::worker_main()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (;;)
+    {
+        // Ticks are spaced from the end of the previous one, so a slow idle
+        // handler or a long render never makes them pile up.
+        if (wake.wait_for(lock, interval, [this] { return stopping; }))
+            return;
+
+        lock.unlock();
+
+        {
+            std::lock_guard<std::mutex> instances(instance_mutex);
+
+            StatsClock::time_point start = StatsClock::now();
+
+            for (AEffect* effect : effects)
+            {
+                if (effect)
+                    effect->dispatcher(effect, DECLARE_VST_DEPRECATED(effIdle), 0, 0, 0, 0);
+            }
+
+            histogram.record_since(start);
+        }
+
+        lock.lock();
+    }
+}
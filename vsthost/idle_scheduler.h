@@ -0,0 +1,41 @@
+#pragma once
+
+#include "host_engine.h"
+#include "host_stats.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Background thread that services effIdle for plugins that asked for it,
+// at most once per interval instead of on every render.
+//
+// The instances are shared with the command loop through `instance_mutex`,
+// which the loop holds for every command that touches them, so an idle call
+// only ever runs while the loop waits for the client. `effects` is read
+// under that mutex as well, the loop may swap or add instances meanwhile.
+class IdleScheduler
+{
+public:
+    IdleScheduler(std::mutex& instance_mutex, const std::vector<AEffect*>& effects, std::chrono::milliseconds interval, LatencyHistogram& histogram);
+    ~IdleScheduler();
+
+    IdleScheduler(const IdleScheduler&) = delete;
+    IdleScheduler& operator=(const IdleScheduler&) = delete;
+
+private:
+    void worker_main();
+
+    std::mutex& instance_mutex;
+    const std::vector<AEffect*>& effects;
+    std::chrono::milliseconds interval;
+    LatencyHistogram& histogram; // written under instance_mutex
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    std::thread worker;
+};
@@ -0,0 +1,163 @@
+#include "instance_pool.h"
+
+InstancePool::InstancePool(main_func entry, audioMasterCallback master, audioMasterData* slot_data, unsigned slot_count, apply_chunk_func apply_chunk)
+    : entry(entry), master(master), slot_data(slot_data), apply_chunk(apply_chunk), slots(slot_count)
+{
+    worker = std::thread(&InstancePool::worker_main, this);
+}
+
+InstancePool::~InstancePool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    wake.notify_one();
+    worker.join();
+
+    for (AEffect* effect : retired)
+        effect->dispatcher(effect, effClose, 0, 0, 0, 0);
+
+    for (Slot& slot : slots)
+    {
+        if (slot.spare)
+            slot.spare->dispatcher(slot.spare, effClose, 0, 0, 0, 0);
+    }
+}
+
+void InstancePool::set_chunk(const std::vector<uint8_t>& new_chunk)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        chunk = new_chunk;
+        chunk_generation++;
+
+        // A new chunk may be what makes a failing plugin instantiate.
+        for (Slot& slot : slots)
+            slot.failed = false;
+    }
+
+    wake.notify_one();
+}
+
+AEffect* InstancePool::take(unsigned slot_index)
+{
+    AEffect* effect = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        Slot& slot = slots[slot_index];
+
+        if (slot.spare && !slot.busy && slot.chunk_generation == chunk_generation)
+        {
+            effect = slot.spare;
+            slot.spare = nullptr;
+        }
+    }
+
+    if (effect)
+        wake.notify_one();
+
+    return effect;
+}
+
+void InstancePool::retire(AEffect* effect)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        retired.push_back(effect);
+    }
+
+    wake.notify_one();
+}
+
+void InstancePool::worker_main()
+{
+    std::vector<uint8_t> work_chunk;
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (;;)
+    {
+        // Closing first gives back the memory the replacements are about to take.
+        if (!retired.empty())
+        {
+            AEffect* effect = retired.back();
+            retired.pop_back();
+
+            lock.unlock();
+            effect->dispatcher(effect, effClose, 0, 0, 0, 0);
+            lock.lock();
+            continue;
+        }
+
+        Slot* target = nullptr;
+        unsigned target_index = 0;
+
+        for (unsigned i = 0; i < slots.size(); ++i)
+        {
+            Slot& slot = slots[i];
+
+            if (!slot.failed && (slot.spare == nullptr || slot.chunk_generation != chunk_generation))
+            {
+                target = &slot;
+                target_index = i;
+                break;
+            }
+        }
+
+        if (target == nullptr)
+        {
+            if (stopping)
+                return;
+
+            wake.wait(lock);
+            continue;
+        }
+
+        if (stopping)
+            return;
+
+        AEffect* effect = target->spare;
+        uint64_t generation = chunk_generation;
+
+        work_chunk = chunk;
+        target->busy = true;
+
+        lock.unlock();
+
+        if (effect == nullptr)
+        {
+            effect = entry(master);
+
+            if (effect && effect->magic == kEffectMagic)
+            {
+                effect->user = &slot_data[target_index];
+                effect->dispatcher(effect, effOpen, 0, 0, 0, 0);
+            }
+            else
+                effect = nullptr;
+        }
+
+        if (effect)
+            apply_chunk(effect, work_chunk);
+
+        lock.lock();
+
+        target->busy = false;
+
+        if (effect)
+        {
+            target->spare = effect;
+            target->chunk_generation = generation;
+        }
+        else
+        {
+            target->failed = true;
+            failed_instances.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
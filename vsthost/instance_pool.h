@@ -0,0 +1,70 @@
+#pragma once
+
+#include "host_engine.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Spare plugin instances prepared on a background thread, so Reset can swap
+// pointers instead of instantiating plugins that load samples on effOpen.
+//
+// There is one spare per instance slot, opened with that slot's
+// audioMasterData and the current chunk applied. Instances retired by a
+// Reset are closed on the same thread. When the chunk changes, spares that
+// were prepared with the old one are handed out no more until the worker
+// applied the new one.
+class InstancePool
+{
+public:
+    typedef void (*apply_chunk_func)(AEffect* effect, const std::vector<uint8_t>& chunk);
+
+    InstancePool(main_func entry, audioMasterCallback master, audioMasterData* slot_data, unsigned slot_count, apply_chunk_func apply_chunk);
+    ~InstancePool();
+
+    InstancePool(const InstancePool&) = delete;
+    InstancePool& operator=(const InstancePool&) = delete;
+
+    void set_chunk(const std::vector<uint8_t>& chunk);
+
+    // Returns the ready spare of `slot`, or nullptr if it is not ready yet.
+    AEffect* take(unsigned slot);
+
+    // Closes `effect` in the background. It must already be stopped.
+    void retire(AEffect* effect);
+
+    uint64_t failures() const { return failed_instances.load(std::memory_order_relaxed); }
+
+private:
+    struct Slot
+    {
+        AEffect* spare = nullptr;
+        uint64_t chunk_generation = 0;
+        bool busy = false;
+        bool failed = false;
+    };
+
+    void worker_main();
+
+    main_func entry;
+    audioMasterCallback master;
+    audioMasterData* slot_data;
+    apply_chunk_func apply_chunk;
+
+    std::vector<Slot> slots;
+    std::vector<AEffect*> retired;
+
+    std::vector<uint8_t> chunk;
+    uint64_t chunk_generation = 0;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    std::atomic<uint64_t> failed_instances{ 0 };
+
+    std::thread worker;
+};
@@ -0,0 +1,825 @@
+#include "mixdown.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define MIXDOWN_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define MIXDOWN_X86 0
+#endif
+
+#if MIXDOWN_X86 && defined(__GNUC__)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+static void mixdown_scalar(float* out, const float* in, size_t channel_stride, size_t instance_stride, unsigned channels, unsigned instances, unsigned count)
+{
+    for (unsigned i = 0; i < count; ++i)
+    {
+        for (unsigned c = 0; c < channels; ++c)
+        {
+            const float* channel_in = in + channel_stride * c + i;
+
+            float sample = channel_in[0];
+
+            for (unsigned n = 1; n < instances; ++n)
+                sample += channel_in[instance_stride * n];
+
+            *out++ = sample;
+        }
+    }
+}
+
+static void mixdown_double_scalar(double* out, const double* in, size_t channel_stride, size_t instance_stride, unsigned channels, unsigned instances, unsigned count)
+{
+    for (unsigned i = 0; i < count; ++i)
+    {
+        for (unsigned c = 0; c < channels; ++c)
+        {
+            const double* channel_in = in + channel_stride * c + i;
+
+            double sample = channel_in[0];
+
+            for (unsigned n = 1; n < instances; ++n)
+                sample += channel_in[instance_stride * n];
+
+            *out++ = sample;
+        }
+    }
+}
+
+static const float DITHER_UNIT = 1.0f / 16777216.0f;
+static const double DITHER_UNIT_DOUBLE = 1.0 / 16777216.0;
+
+struct FormatRange
+{
+    float scale;
+    float low;
+    float high;
+};
+
+static FormatRange format_range(SampleFormat format)
+{
+    if (format == SampleFormat::Int16)
+        return { 32768.0f, -32768.0f, 32767.0f };
+    else
+        return { 8388608.0f, -8388608.0f, 8388607.0f };
+}
+
+static inline uint32_t xorshift(uint32_t x)
+{
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+static inline void store_sample(uint8_t* out, int32_t value, SampleFormat format)
+{
+    if (format == SampleFormat::Int16)
+    {
+        int16_t sample = (int16_t)value;
+        memcpy(out, &sample, sizeof(sample));
+    }
+    else
+    {
+        out[0] = (uint8_t)value;
+        out[1] = (uint8_t)(value >> 8);
+        out[2] = (uint8_t)(value >> 16);
+    }
+}
+
+static void convert_scalar(void* out, const float* in, unsigned count, SampleFormat format, DitherState& dither)
+{
+    if (format == SampleFormat::Float32)
+    {
+        memcpy(out, in, count * sizeof(float));
+        return;
+    }
+
+    if (format == SampleFormat::Float64)
+    {
+        double* out_samples = (double*)out;
+
+        for (unsigned i = 0; i < count; ++i)
+            out_samples[i] = in[i];
+
+        return;
+    }
+
+    FormatRange range = format_range(format);
+    unsigned bytes = sample_format_bytes(format);
+
+    uint8_t* out_bytes = (uint8_t*)out;
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        float sample = in[i] * range.scale;
+
+        if (dither.enabled)
+        {
+            uint32_t& lane = dither.lanes[i & 3];
+
+            uint32_t a = xorshift(lane);
+            uint32_t b = xorshift(a);
+
+            lane = b;
+
+            sample += (float)(int32_t)(a >> 8) * DITHER_UNIT - (float)(int32_t)(b >> 8) * DITHER_UNIT;
+        }
+
+        // same operand order as minps/maxps, so NaN ends up at the top of the range on every path
+        sample = sample < range.high ? sample : range.high;
+        sample = sample > range.low ? sample : range.low;
+
+        store_sample(out_bytes, (int32_t)std::lrintf(sample), format);
+
+        out_bytes += bytes;
+    }
+}
+
+static void convert_double_scalar(void* out, const double* in, unsigned count, SampleFormat format, DitherState& dither)
+{
+    if (format == SampleFormat::Float64)
+    {
+        memcpy(out, in, count * sizeof(double));
+        return;
+    }
+
+    if (format == SampleFormat::Float32)
+    {
+        float* out_samples = (float*)out;
+
+        for (unsigned i = 0; i < count; ++i)
+            out_samples[i] = (float)in[i];
+
+        return;
+    }
+
+    FormatRange range = format_range(format);
+    unsigned bytes = sample_format_bytes(format);
+
+    uint8_t* out_bytes = (uint8_t*)out;
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        double sample = in[i] * (double)range.scale;
+
+        if (dither.enabled)
+        {
+            uint32_t& lane = dither.lanes[i & 3];
+
+            uint32_t a = xorshift(lane);
+            uint32_t b = xorshift(a);
+
+            lane = b;
+
+            sample += (double)(int32_t)(a >> 8) * DITHER_UNIT_DOUBLE - (double)(int32_t)(b >> 8) * DITHER_UNIT_DOUBLE;
+        }
+
+        sample = sample < (double)range.high ? sample : (double)range.high;
+        sample = sample > (double)range.low ? sample : (double)range.low;
+
+        store_sample(out_bytes, (int32_t)std::lrint(sample), format);
+
+        out_bytes += bytes;
+    }
+}
+
+#if MIXDOWN_X86
+
+TARGET_SSE2 static void mixdown_sse2(float* out, const float* in, size_t channel_stride, size_t instance_stride, unsigned channels, unsigned instances, unsigned count)
+{
+    unsigned i = 0;
+
+    if (channels == 2)
+    {
+        const float* left_in = in;
+        const float* right_in = in + channel_stride;
+
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 left = _mm_loadu_ps(left_in + i);
+            __m128 right = _mm_loadu_ps(right_in + i);
+
+            for (unsigned n = 1; n < instances; ++n)
+            {
+                left = _mm_add_ps(left, _mm_loadu_ps(left_in + instance_stride * n + i));
+                right = _mm_add_ps(right, _mm_loadu_ps(right_in + instance_stride * n + i));
+            }
+
+            _mm_storeu_ps(out + i * 2, _mm_unpacklo_ps(left, right));
+            _mm_storeu_ps(out + i * 2 + 4, _mm_unpackhi_ps(left, right));
+        }
+    }
+    else if (channels == 1)
+    {
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 sample = _mm_loadu_ps(in + i);
+
+            for (unsigned n = 1; n < instances; ++n)
+                sample = _mm_add_ps(sample, _mm_loadu_ps(in + instance_stride * n + i));
+
+            _mm_storeu_ps(out + i, sample);
+        }
+    }
+    else
+    {
+        // Surround outputs and stems: four frames of four channels at a
+        // time, transposed into frame order. A remainder of channels is
+        // summed the same way and stored one sample at a time.
+        for (; i + 4 <= count; i += 4)
+        {
+            for (unsigned c = 0; c < channels; c += 4)
+            {
+                unsigned group = channels - c < 4 ? channels - c : 4;
+
+                __m128 rows[4] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+
+                for (unsigned k = 0; k < group; ++k)
+                {
+                    const float* channel_in = in + channel_stride * (c + k) + i;
+
+                    __m128 sample = _mm_loadu_ps(channel_in);
+
+                    for (unsigned n = 1; n < instances; ++n)
+                        sample = _mm_add_ps(sample, _mm_loadu_ps(channel_in + instance_stride * n));
+
+                    rows[k] = sample;
+                }
+
+                _MM_TRANSPOSE4_PS(rows[0], rows[1], rows[2], rows[3]);
+
+                if (group == 4)
+                {
+                    for (unsigned k = 0; k < 4; ++k)
+                        _mm_storeu_ps(out + (i + k) * channels + c, rows[k]);
+                }
+                else
+                {
+                    for (unsigned k = 0; k < 4; ++k)
+                    {
+                        float frame[4];
+
+                        _mm_storeu_ps(frame, rows[k]);
+
+                        memcpy(out + (i + k) * channels + c, frame, group * sizeof(float));
+                    }
+                }
+            }
+        }
+    }
+
+    if (i < count)
+        mixdown_scalar(out + i * channels, in + i, channel_stride, instance_stride, channels, instances, count - i);
+}
+
+TARGET_AVX2 static void mixdown_avx2(float* out, const float* in, size_t channel_stride, size_t instance_stride, unsigned channels, unsigned instances, unsigned count)
+{
+    unsigned i = 0;
+
+    if (channels == 2)
+    {
+        const float* left_in = in;
+        const float* right_in = in + channel_stride;
+
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 left = _mm256_loadu_ps(left_in + i);
+            __m256 right = _mm256_loadu_ps(right_in + i);
+
+            for (unsigned n = 1; n < instances; ++n)
+            {
+                left = _mm256_add_ps(left, _mm256_loadu_ps(left_in + instance_stride * n + i));
+                right = _mm256_add_ps(right, _mm256_loadu_ps(right_in + instance_stride * n + i));
+            }
+
+            // unpack works within 128-bit lanes, the permutes put the frames back in order
+            __m256 low = _mm256_unpacklo_ps(left, right);
+            __m256 high = _mm256_unpackhi_ps(left, right);
+
+            _mm256_storeu_ps(out + i * 2, _mm256_permute2f128_ps(low, high, 0x20));
+            _mm256_storeu_ps(out + i * 2 + 8, _mm256_permute2f128_ps(low, high, 0x31));
+        }
+    }
+    else if (channels == 1)
+    {
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 sample = _mm256_loadu_ps(in + i);
+
+            for (unsigned n = 1; n < instances; ++n)
+                sample = _mm256_add_ps(sample, _mm256_loadu_ps(in + instance_stride * n + i));
+
+            _mm256_storeu_ps(out + i, sample);
+        }
+    }
+
+    // the rest of the frames, and more than two channels, go through the SSE2 code
+    if (i < count)
+        mixdown_sse2(out + i * channels, in + i, channel_stride, instance_stride, channels, instances, count - i);
+}
+
+TARGET_SSE2 static void mixdown_double_sse2(double* out, const double* in, size_t channel_stride, size_t instance_stride, unsigned channels, unsigned instances, unsigned count)
+{
+    unsigned i = 0;
+
+    if (channels == 2)
+    {
+        const double* left_in = in;
+        const double* right_in = in + channel_stride;
+
+        for (; i + 2 <= count; i += 2)
+        {
+            __m128d left = _mm_loadu_pd(left_in + i);
+            __m128d right = _mm_loadu_pd(right_in + i);
+
+            for (unsigned n = 1; n < instances; ++n)
+            {
+                left = _mm_add_pd(left, _mm_loadu_pd(left_in + instance_stride * n + i));
+                right = _mm_add_pd(right, _mm_loadu_pd(right_in + instance_stride * n + i));
+            }
+
+            _mm_storeu_pd(out + i * 2, _mm_unpacklo_pd(left, right));
+            _mm_storeu_pd(out + i * 2 + 2, _mm_unpackhi_pd(left, right));
+        }
+    }
+    else if (channels == 1)
+    {
+        for (; i + 2 <= count; i += 2)
+        {
+            __m128d sample = _mm_loadu_pd(in + i);
+
+            for (unsigned n = 1; n < instances; ++n)
+                sample = _mm_add_pd(sample, _mm_loadu_pd(in + instance_stride * n + i));
+
+            _mm_storeu_pd(out + i, sample);
+        }
+    }
+    else
+    {
+        // Two frames of two channels at a time, the unpacks put them in
+        // frame order. An odd last channel is stored one sample at a time.
+        for (; i + 2 <= count; i += 2)
+        {
+            for (unsigned c = 0; c < channels; c += 2)
+            {
+                const double* first_in = in + channel_stride * c + i;
+
+                __m128d first = _mm_loadu_pd(first_in);
+
+                for (unsigned n = 1; n < instances; ++n)
+                    first = _mm_add_pd(first, _mm_loadu_pd(first_in + instance_stride * n));
+
+                if (c + 1 == channels)
+                {
+                    _mm_storel_pd(out + i * channels + c, first);
+                    _mm_storeh_pd(out + (i + 1) * channels + c, first);
+                    break;
+                }
+
+                const double* second_in = first_in + channel_stride;
+
+                __m128d second = _mm_loadu_pd(second_in);
+
+                for (unsigned n = 1; n < instances; ++n)
+                    second = _mm_add_pd(second, _mm_loadu_pd(second_in + instance_stride * n));
+
+                _mm_storeu_pd(out + i * channels + c, _mm_unpacklo_pd(first, second));
+                _mm_storeu_pd(out + (i + 1) * channels + c, _mm_unpackhi_pd(first, second));
+            }
+        }
+    }
+
+    if (i < count)
+        mixdown_double_scalar(out + i * channels, in + i, channel_stride, instance_stride, channels, instances, count - i);
+}
+
+TARGET_AVX2 static void mixdown_double_avx2(double* out, const double* in, size_t channel_stride, size_t instance_stride, unsigned channels, unsigned instances, unsigned count)
+{
+    unsigned i = 0;
+
+    if (channels == 2)
+    {
+        const double* left_in = in;
+        const double* right_in = in + channel_stride;
+
+        for (; i + 4 <= count; i += 4)
+        {
+            __m256d left = _mm256_loadu_pd(left_in + i);
+            __m256d right = _mm256_loadu_pd(right_in + i);
+
+            for (unsigned n = 1; n < instances; ++n)
+            {
+                left = _mm256_add_pd(left, _mm256_loadu_pd(left_in + instance_stride * n + i));
+                right = _mm256_add_pd(right, _mm256_loadu_pd(right_in + instance_stride * n + i));
+            }
+
+            __m256d low = _mm256_unpacklo_pd(left, right);
+            __m256d high = _mm256_unpackhi_pd(left, right);
+
+            _mm256_storeu_pd(out + i * 2, _mm256_permute2f128_pd(low, high, 0x20));
+            _mm256_storeu_pd(out + i * 2 + 4, _mm256_permute2f128_pd(low, high, 0x31));
+        }
+    }
+    else if (channels == 1)
+    {
+        for (; i + 4 <= count; i += 4)
+        {
+            __m256d sample = _mm256_loadu_pd(in + i);
+
+            for (unsigned n = 1; n < instances; ++n)
+                sample = _mm256_add_pd(sample, _mm256_loadu_pd(in + instance_stride * n + i));
+
+            _mm256_storeu_pd(out + i, sample);
+        }
+    }
+
+    // the rest of the frames, and more than two channels, go through the SSE2 code
+    if (i < count)
+        mixdown_double_sse2(out + i * channels, in + i, channel_stride, instance_stride, channels, instances, count - i);
+}
+
+TARGET_SSE2 static inline __m128i xorshift_sse2(__m128i x)
+{
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+    return x;
+}
+
+TARGET_SSE2 static void convert_sse2(void* out, const float* in, unsigned count, SampleFormat format, DitherState& dither)
+{
+    if (format == SampleFormat::Float32)
+    {
+        memcpy(out, in, count * sizeof(float));
+        return;
+    }
+
+    if (format == SampleFormat::Float64)
+    {
+        double* out_samples = (double*)out;
+
+        unsigned i = 0;
+
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 sample = _mm_loadu_ps(in + i);
+
+            _mm_storeu_pd(out_samples + i, _mm_cvtps_pd(sample));
+            _mm_storeu_pd(out_samples + i + 2, _mm_cvtps_pd(_mm_movehl_ps(sample, sample)));
+        }
+
+        if (i < count)
+            convert_scalar(out_samples + i, in + i, count - i, format, dither);
+
+        return;
+    }
+
+    FormatRange range = format_range(format);
+    unsigned bytes = sample_format_bytes(format);
+
+    const __m128 scale = _mm_set1_ps(range.scale);
+    const __m128 low = _mm_set1_ps(range.low);
+    const __m128 high = _mm_set1_ps(range.high);
+    const __m128 unit = _mm_set1_ps(DITHER_UNIT);
+
+    __m128i lanes = _mm_loadu_si128((const __m128i*)dither.lanes);
+
+    uint8_t* out_bytes = (uint8_t*)out;
+
+    unsigned i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 sample = _mm_mul_ps(_mm_loadu_ps(in + i), scale);
+
+        if (dither.enabled)
+        {
+            __m128i a = xorshift_sse2(lanes);
+            __m128i b = xorshift_sse2(a);
+
+            lanes = b;
+
+            __m128 noise = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(a, 8)), unit), _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(b, 8)), unit));
+
+            sample = _mm_add_ps(sample, noise);
+        }
+
+        sample = _mm_max_ps(_mm_min_ps(sample, high), low);
+
+        __m128i value = _mm_cvtps_epi32(sample);
+
+        if (format == SampleFormat::Int16)
+        {
+            _mm_storel_epi64((__m128i*)out_bytes, _mm_packs_epi32(value, value));
+        }
+        else
+        {
+            int32_t values[4];
+
+            _mm_storeu_si128((__m128i*)values, value);
+
+            for (unsigned j = 0; j < 4; ++j)
+                store_sample(out_bytes + j * 3, values[j], format);
+        }
+
+        out_bytes += bytes * 4;
+    }
+
+    _mm_storeu_si128((__m128i*)dither.lanes, lanes);
+
+    if (i < count)
+        convert_scalar(out_bytes, in + i, count - i, format, dither);
+}
+
+TARGET_SSE2 static void convert_double_sse2(void* out, const double* in, unsigned count, SampleFormat format, DitherState& dither)
+{
+    if (format == SampleFormat::Float64)
+    {
+        memcpy(out, in, count * sizeof(double));
+        return;
+    }
+
+    unsigned i = 0;
+
+    if (format == SampleFormat::Float32)
+    {
+        float* out_samples = (float*)out;
+
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 low = _mm_cvtpd_ps(_mm_loadu_pd(in + i));
+            __m128 high = _mm_cvtpd_ps(_mm_loadu_pd(in + i + 2));
+
+            _mm_storeu_ps(out_samples + i, _mm_movelh_ps(low, high));
+        }
+
+        if (i < count)
+            convert_double_scalar(out_samples + i, in + i, count - i, format, dither);
+
+        return;
+    }
+
+    FormatRange range = format_range(format);
+    unsigned bytes = sample_format_bytes(format);
+
+    const __m128d scale = _mm_set1_pd(range.scale);
+    const __m128d low = _mm_set1_pd(range.low);
+    const __m128d high = _mm_set1_pd(range.high);
+    const __m128d unit = _mm_set1_pd(DITHER_UNIT_DOUBLE);
+
+    __m128i lanes = _mm_loadu_si128((const __m128i*)dither.lanes);
+
+    uint8_t* out_bytes = (uint8_t*)out;
+
+    // four samples a round, so the dither lanes line up with the scalar path
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128d first = _mm_mul_pd(_mm_loadu_pd(in + i), scale);
+        __m128d second = _mm_mul_pd(_mm_loadu_pd(in + i + 2), scale);
+
+        if (dither.enabled)
+        {
+            __m128i a = xorshift_sse2(lanes);
+            __m128i b = xorshift_sse2(a);
+
+            lanes = b;
+
+            __m128i a_bits = _mm_srli_epi32(a, 8);
+            __m128i b_bits = _mm_srli_epi32(b, 8);
+
+            __m128d first_noise = _mm_sub_pd(_mm_mul_pd(_mm_cvtepi32_pd(a_bits), unit), _mm_mul_pd(_mm_cvtepi32_pd(b_bits), unit));
+            __m128d second_noise = _mm_sub_pd(_mm_mul_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(a_bits, a_bits)), unit), _mm_mul_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(b_bits, b_bits)), unit));
+
+            first = _mm_add_pd(first, first_noise);
+            second = _mm_add_pd(second, second_noise);
+        }
+
+        first = _mm_max_pd(_mm_min_pd(first, high), low);
+        second = _mm_max_pd(_mm_min_pd(second, high), low);
+
+        __m128i value = _mm_unpacklo_epi64(_mm_cvtpd_epi32(first), _mm_cvtpd_epi32(second));
+
+        if (format == SampleFormat::Int16)
+        {
+            _mm_storel_epi64((__m128i*)out_bytes, _mm_packs_epi32(value, value));
+        }
+        else
+        {
+            int32_t values[4];
+
+            _mm_storeu_si128((__m128i*)values, value);
+
+            for (unsigned j = 0; j < 4; ++j)
+                store_sample(out_bytes + j * 3, values[j], format);
+        }
+
+        out_bytes += bytes * 4;
+    }
+
+    _mm_storeu_si128((__m128i*)dither.lanes, lanes);
+
+    if (i < count)
+        convert_double_scalar(out_bytes, in + i, count - i, format, dither);
+}
+
+static bool cpu_has_sse2()
+{
+#ifdef _MSC_VER
+    int info[4];
+
+    __cpuid(info, 1);
+
+    return (info[3] & (1 << 26)) != 0;
+#else
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+static bool cpu_has_avx2()
+{
+#ifdef _MSC_VER
+    int info[4];
+
+    __cpuid(info, 0);
+
+    if (info[0] < 7)
+        return false;
+
+    __cpuid(info, 1);
+
+    // AVX state has to be enabled by the OS as well
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+        return false;
+
+    __cpuidex(info, 7, 0);
+
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+MixdownIsa mixdown_detect_isa()
+{
+#if MIXDOWN_X86
+    if (cpu_has_avx2())
+        return MixdownIsa::AVX2;
+
+    if (cpu_has_sse2())
+        return MixdownIsa::SSE2;
+#endif
+
+    return MixdownIsa::Scalar;
+}
+
+MixdownKernel mixdown_kernel(MixdownIsa isa)
+{
+    switch (isa)
+    {
+    case MixdownIsa::Scalar:
+        return mixdown_scalar;
+
+#if MIXDOWN_X86
+    case MixdownIsa::SSE2:
+        return mixdown_sse2;
+
+    case MixdownIsa::AVX2:
+        return mixdown_avx2;
+#endif
+
+    default:
+        return nullptr;
+    }
+}
+
+MixdownDoubleKernel mixdown_double_kernel(MixdownIsa isa)
+{
+    switch (isa)
+    {
+    case MixdownIsa::Scalar:
+        return mixdown_double_scalar;
+
+#if MIXDOWN_X86
+    case MixdownIsa::SSE2:
+        return mixdown_double_sse2;
+
+    case MixdownIsa::AVX2:
+        return mixdown_double_avx2;
+#endif
+
+    default:
+        return nullptr;
+    }
+}
+
+const char* mixdown_isa_name(MixdownIsa isa)
+{
+    switch (isa)
+    {
+    case MixdownIsa::SSE2:
+        return "sse2";
+
+    case MixdownIsa::AVX2:
+        return "avx2";
+
+    default:
+        return "scalar";
+    }
+}
+
+void mixdown(float* out, const float* in, size_t channel_stride, size_t instance_stride, unsigned channels, unsigned instances, unsigned count)
+{
+    static const MixdownKernel kernel = mixdown_kernel(mixdown_detect_isa());
+
+    kernel(out, in, channel_stride, instance_stride, channels, instances, count);
+}
+
+void mixdown_double(double* out, const double* in, size_t channel_stride, size_t instance_stride, unsigned channels, unsigned instances, unsigned count)
+{
+    static const MixdownDoubleKernel kernel = mixdown_double_kernel(mixdown_detect_isa());
+
+    kernel(out, in, channel_stride, instance_stride, channels, instances, count);
+}
+
+unsigned sample_format_bytes(SampleFormat format)
+{
+    switch (format)
+    {
+    case SampleFormat::Float64:
+        return 8;
+
+    case SampleFormat::Int16:
+        return 2;
+
+    case SampleFormat::Int24:
+        return 3;
+
+    default:
+        return 4;
+    }
+}
+
+ConvertKernel convert_kernel(MixdownIsa isa)
+{
+    switch (isa)
+    {
+    case MixdownIsa::Scalar:
+        return convert_scalar;
+
+#if MIXDOWN_X86
+    // the conversion is bound by the stores, so the AVX2 build shares the SSE2 code
+    case MixdownIsa::SSE2:
+    case MixdownIsa::AVX2:
+        return convert_sse2;
+#endif
+
+    default:
+        return nullptr;
+    }
+}
+
+void convert_samples(void* out, const float* in, unsigned count, SampleFormat format, DitherState& dither)
+{
+    static const ConvertKernel kernel = convert_kernel(mixdown_detect_isa());
+
+    kernel(out, in, count, format, dither);
+}
+
+ConvertDoubleKernel convert_double_kernel(MixdownIsa isa)
+{
+    switch (isa)
+    {
+    case MixdownIsa::Scalar:
+        return convert_double_scalar;
+
+#if MIXDOWN_X86
+    case MixdownIsa::SSE2:
+    case MixdownIsa::AVX2:
+        return convert_double_sse2;
+#endif
+
+    default:
+        return nullptr;
+    }
+}
+
+void convert_samples_double(void* out, const double* in, unsigned count, SampleFormat format, DitherState& dither)
+{
+    static const ConvertDoubleKernel kernel = convert_double_kernel(mixdown_detect_isa());
+
+    kernel(out, in, count, format, dither);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Sums the outputs of all plugin instances and interleaves them into the
+// reply buffer in one pass.
+//
+// Sample s of channel c of instance i is read from
+// in[i * instance_stride + c * channel_stride + s], and frame s of the result
+// is written to out[s * channels .. s * channels + channels - 1]. Instances
+// are always added in index order without fused operations, so every
+// implementation produces bit-identical results.
+//
+// Mono and stereo have their own vector paths. Wider layouts are transposed
+// in groups of channels. Unsummed stems are interleaved by the same kernels,
+// as a single instance whose channels are those of all instances in a row.
+enum class MixdownIsa
+{
+    Scalar,
+    SSE2,
+    AVX2
+};
+
+// Floats of padding the host leaves after every channel buffer. Block sizes
+// are mostly powers of two, and without it every input stream of a mix of
+// many instances maps to the same cache sets.
+enum
+{
+    MIXDOWN_CHANNEL_PADDING = 16
+};
+
+typedef void (*MixdownKernel)(float* out, const float* in, size_t channel_stride, size_t instance_stride, unsigned channels, unsigned instances, unsigned count);
+
+// Best instruction set supported by both the build and the running CPU.
+MixdownIsa mixdown_detect_isa();
+
+// Kernel for a specific instruction set, or nullptr if the build lacks it.
+MixdownKernel mixdown_kernel(MixdownIsa isa);
+
+const char* mixdown_isa_name(MixdownIsa isa);
+
+// Kernel picked by CPU feature detection on first use.
+void mixdown(float* out, const float* in, size_t channel_stride, size_t instance_stride, unsigned channels, unsigned instances, unsigned count);
+
+// The same for instances rendering through processDoubleReplacing, strides
+// are in doubles.
+typedef void (*MixdownDoubleKernel)(double* out, const double* in, size_t channel_stride, size_t instance_stride, unsigned channels, unsigned instances, unsigned count);
+
+MixdownDoubleKernel mixdown_double_kernel(MixdownIsa isa);
+
+void mixdown_double(double* out, const double* in, size_t channel_stride, size_t instance_stride, unsigned channels, unsigned instances, unsigned count);
+
+// Sample formats the reply can be converted to. Integer formats are little
+// endian; Int24 is packed into three bytes per sample.
+enum class SampleFormat : uint32_t
+{
+    Float32 = 0,
+    Int24,
+    Int16,
+    Float64
+};
+
+unsigned sample_format_bytes(SampleFormat format);
+
+// Triangular (TPDF) dither of +-1 LSB for the integer formats. Sample k of a
+// conversion draws two values from xorshift lane k % 4, which is what the
+// SSE2 path computes four samples at a time, so dithered output does not
+// depend on the instruction set either.
+struct DitherState
+{
+    bool enabled = false;
+    uint32_t lanes[4] = { 0x9E3779B9u, 0x7F4A7C15u, 0x85EBCA6Bu, 0xC2B2AE35u };
+};
+
+typedef void (*ConvertKernel)(void* out, const float* in, unsigned count, SampleFormat format, DitherState& dither);
+
+ConvertKernel convert_kernel(MixdownIsa isa);
+
+// Converts `count` interleaved samples from float to another format.
+void convert_samples(void* out, const float* in, unsigned count, SampleFormat format, DitherState& dither);
+
+// The same from double, which is also narrowed to Float32 this way. Integer
+// formats are scaled and dithered in double, so a double render keeps its
+// precision down to the last bit of the output.
+typedef void (*ConvertDoubleKernel)(void* out, const double* in, unsigned count, SampleFormat format, DitherState& dither);
+
+ConvertDoubleKernel convert_double_kernel(MixdownIsa isa);
+
+void convert_samples_double(void* out, const double* in, unsigned count, SampleFormat format, DitherState& dither);
@@ -0,0 +1,93 @@
+#include "plugin_module.h"
+
+#ifdef _WIN32
+#include "stdafx.h"
+#else
+#include <dlfcn.h>
+#endif
+
+static const char* const entry_names[] = { "VSTPluginMain", "main", "MAIN" };
+
+PluginModule::~PluginModule()
+{
+    unload();
+}
+
+#ifdef _WIN32
+
+bool PluginModule::load(const char* path)
+{
+    unload();
+
+    handle = ::LoadLibraryA(path);
+
+    return handle != nullptr;
+}
+
+void PluginModule::unload()
+{
+    if (handle)
+    {
+        FreeLibrary((HMODULE)handle);
+        handle = nullptr;
+    }
+}
+
+main_func PluginModule::entry() const
+{
+    if (handle == nullptr)
+        return nullptr;
+
+#pragma warning(disable : 4191) // unsafe conversion from 'FARPROC' to 'main_func'
+    for (const char* name : entry_names)
+    {
+        main_func Main = (main_func)::GetProcAddress((HMODULE)handle, name);
+
+        if (Main)
+            return Main;
+    }
+#pragma warning(default : 4191)
+
+    return nullptr;
+}
+
+#else
+
+bool PluginModule::load(const char* path)
+{
+    unload();
+
+    // Resolve everything up front, a missing symbol should fail the load and
+    // not the first render. Local binding keeps plugins that bundle the same
+    // libraries from resolving into each other.
+    handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+
+    return handle != nullptr;
+}
+
+void PluginModule::unload()
+{
+    if (handle)
+    {
+        dlclose(handle);
+        handle = nullptr;
+    }
+}
+
+main_func PluginModule::entry() const
+{
+    if (handle == nullptr)
+        return nullptr;
+
+    for (const char* name : entry_names)
+    {
+        main_func Main = (main_func)dlsym(handle, name);
+
+        if (Main)
+            return Main;
+    }
+
+    return nullptr;
+}
+
+#endif
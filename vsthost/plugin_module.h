@@ -0,0 +1,24 @@
+#pragma once
+
+#include "host_engine.h"
+
+// The plugin binary: a DLL on Windows, a shared object elsewhere. Both are
+// searched for the same entry points, VSTPluginMain first and then the
+// legacy main and MAIN.
+class PluginModule
+{
+public:
+    PluginModule() = default;
+    ~PluginModule();
+
+    PluginModule(const PluginModule&) = delete;
+    PluginModule& operator=(const PluginModule&) = delete;
+
+    bool load(const char* path);
+    void unload();
+
+    main_func entry() const;
+
+private:
+    void* handle = nullptr;
+};
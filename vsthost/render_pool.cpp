@@ -0,0 +1,112 @@
+#include "render_pool.h"
+
+RenderPool::RenderPool(unsigned worker_count)
+{
+    workers.reserve(worker_count);
+
+    for (unsigned i = 0; i < worker_count; ++i)
+        workers.emplace_back(&RenderPool::worker_main, this);
+}
+
+RenderPool::~RenderPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    wake.notify_all();
+
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+void RenderPool::run(unsigned count, void (*task)(void*, unsigned), void* context)
+{
+    if (count == 0)
+        return;
+
+    if (workers.empty() || count == 1)
+    {
+        for (unsigned i = 0; i < count; ++i)
+            task(context, i);
+
+        return;
+    }
+
+    uint32_t job_generation;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        job_generation = ++generation;
+        job_count = count;
+        job_task = task;
+        job_context = context;
+
+        done.store(0, std::memory_order_relaxed);
+        ticket.store((uint64_t)job_generation << 32, std::memory_order_release);
+    }
+
+    wake.notify_all();
+
+    drain(job_generation, count, task, context);
+
+    if (done.load(std::memory_order_acquire) != count)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        finished.wait(lock, [&] { return done.load(std::memory_order_acquire) == count; });
+    }
+}
+
+void RenderPool::worker_main()
+{
+    uint32_t seen = 0;
+
+    for (;;)
+    {
+        uint32_t job_generation;
+        unsigned count;
+        void (*task)(void*, unsigned);
+        void* context;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+
+            if (stopping)
+                return;
+
+            seen = job_generation = generation;
+            count = job_count;
+            task = job_task;
+            context = job_context;
+        }
+
+        drain(job_generation, count, task, context);
+    }
+}
+
+void RenderPool::drain(uint32_t job_generation, unsigned count, void (*task)(void*, unsigned), void* context)
+{
+    for (;;)
+    {
+        uint64_t current = ticket.load(std::memory_order_acquire);
+
+        if ((uint32_t)(current >> 32) != job_generation || (uint32_t)current >= count)
+            return;
+
+        if (!ticket.compare_exchange_weak(current, current + 1, std::memory_order_acq_rel))
+            continue;
+
+        task(context, (unsigned)(uint32_t)current);
+
+        if (done.fetch_add(1, std::memory_order_acq_rel) + 1 == count)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.notify_all();
+        }
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads used to run the plugin instances of one render
+// block concurrently.
+//
+// run() publishes a job, takes part in it from the calling thread and only
+// returns once every index has been processed, so the caller can mix down
+// right after it. Indices are claimed from a ticket that also carries the
+// job generation, which keeps a worker that wakes up late from picking up
+// work of a job that already finished.
+class RenderPool
+{
+public:
+    explicit RenderPool(unsigned worker_count);
+    ~RenderPool();
+
+    RenderPool(const RenderPool&) = delete;
+    RenderPool& operator=(const RenderPool&) = delete;
+
+    unsigned size() const { return (unsigned)workers.size(); }
+
+    void run(unsigned count, void (*task)(void* context, unsigned index), void* context);
+
+    template <typename F>
+    void run(unsigned count, F& task)
+    {
+        run(count, [](void* context, unsigned index) { (*(F*)context)(index); }, &task);
+    }
+
+private:
+    void worker_main();
+    void drain(uint32_t generation, unsigned count, void (*task)(void*, unsigned), void* context);
+
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+
+    uint32_t generation = 0;
+    unsigned job_count = 0;
+    void (*job_task)(void*, unsigned) = nullptr;
+    void* job_context = nullptr;
+    bool stopping = false;
+
+    std::atomic<uint64_t> ticket{ 0 };
+    std::atomic<unsigned> done{ 0 };
+};